@@ -0,0 +1,23 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "sched.h"
+
+int main(int argc, char *argv[])
+{
+    struct balancestat st[NCPU];
+    int i, n;
+
+    if((n = getbalancestats(st, NCPU)) < 0) {
+        printf(1, "getbalancestats failed\n");
+        exit();
+    }
+
+    printf(1, "cpu\tload\tqueued\tbalances\tpulled\tmigrations\n");
+    for(i = 0; i < n; i++)
+        printf(1, "%d\t%d\t%d\t%d\t\t%d\t%d\n", i, st[i].load, st[i].nqueued,
+               st[i].balances, st[i].pulled, st[i].migrations);
+
+    exit();
+}
@@ -6,3 +6,11 @@ struct rtcdate {
   uint month;
   uint year;
 };
+
+struct timespec {
+  int tv_sec;
+  int tv_nsec;
+};
+
+// Clocks for clock_gettime().
+#define CLOCK_MONOTONIC 1  // nanoseconds since boot, from the TSC
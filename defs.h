@@ -4,10 +4,16 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct balancestat;
+struct procstats;
+struct sched_attr;
+struct spawn_action;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct timespec;
+struct traceevent;
 struct superblock;
 
 // bio.c
@@ -24,6 +30,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             loadexec(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -68,6 +75,11 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kzalloc(void);
+int             kzfill(void);
+void            kref(char*);
+int             krefs(char*);
+int             kfreepages(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,8 +90,16 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
+uint            lapicleft(void);
+void            lapiconeshot(uint);
+extern uint     lapicperus;
+void            lapicperiodic(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
+extern uint64   tscboot;
+extern uint     tscperms;
+extern uint     tscperus;
 
 // log.c
 void            initlog(int dev);
@@ -106,6 +126,7 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             spawn(char*, char**, struct spawn_action*, int);
 int             growproc(int);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -119,6 +140,7 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeup_one(void*);
 void            yield(void);
 int             largest_prime_factor(int n);
 int             change_size(char* path, int size);
@@ -128,9 +150,35 @@ int             set_tickets(int, int);
 int             print_process(void);
 int             sys_set_bjf_params(int, int, int);
 int             proc_set_bjf_params(int, int, int, int);
+int             getprocstats(int, struct procstats*);
+int             set_affinity(int, uint);
+int             setpgid(int, int);
+int             set_gang(int, int);
+int             set_deadline(int, int, int, int);
+int             sched_setattr_batch(struct sched_attr*, int);
 int             sem_init(int, int);
 int             sem_acquire(int);
 int             sem_release(int);
+uint            random(uint);
+
+// runqueue.c
+void            rqinit(void);
+void            rq_add(struct proc*);
+void            rq_age(int);
+void            rq_balance(int);
+int             rq_balancestats(struct balancestat*, int);
+int             rq_gangpreempt(struct proc*);
+void            bjfrank(struct proc*);
+int             rq_idle(int);
+struct proc*    rq_pick(int);
+int             rq_quantum(int);
+int             rq_remove(struct proc*);
+void            rq_replenish(int);
+int             rq_setdeadline(struct proc*, int, int, int);
+int             rq_setagelimit(int);
+int             rq_setpolicy(int);
+int             rq_setquantum(int, int);
+int             rq_tick(struct proc*);
 
 
 
@@ -170,7 +218,19 @@ int             fetchstr(uint, char**);
 void            syscall(void);
 
 // timer.c
+int             hrtimerintr(void);
+void            monotime(struct timespec*);
+uint64          nsuptime(void);
+uint64          tsctons(uint64);
 void            timerinit(void);
+void            timertick(void);
+int             tsleep(int);
+int             usleep(uint);
+
+// trace.c
+void            traceinit(void);
+int             traceread(struct traceevent*, int);
+void            tracesched(int, struct proc*, int);
 
 // trap.c
 void            idtinit(void);
@@ -194,6 +254,9 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowfault(pde_t*, uint);
+int             lazyfault(pde_t*, uint, uint);
+int             uvmtouch(pde_t*, uint, uint, uint, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
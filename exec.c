@@ -7,8 +7,12 @@
 #include "x86.h"
 #include "elf.h"
 
+// Load the program at path with arguments argv into a new
+// address space for p, which is either the current process
+// or a new one from spawn(), and free p's old address space.
+// On failure p is left as it was.
 int
-exec(char *path, char **argv)
+loadexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -17,7 +21,6 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
 
   begin_op();
 
@@ -91,16 +94,18 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  oldpgdir = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  if(p == myproc())
+    switchuvm(p);
+  if(oldpgdir)
+    freevm(oldpgdir);
   return 0;
 
  bad:
@@ -112,3 +117,9 @@ exec(char *path, char **argv)
   }
   return -1;
 }
+
+int
+exec(char *path, char **argv)
+{
+  return loadexec(myproc(), path, argv);
+}
@@ -1,6 +1,21 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Each CPU keeps a magazine of up to KMAG free pages, so most
+// kalloc() and kfree() calls take only that CPU's own lock,
+// which other CPUs touch only when memory is nearly gone. An
+// empty magazine is refilled, and a full one drained, KBATCH
+// pages at a time from the global free list under kmem.lock.
+// Once that list is empty too, kalloc() takes pages from the
+// other CPUs' magazines.
+//
+// Every page has a reference count so copy-on-write fork can
+// share it; kfree() only frees a page when its count drops to 0.
+//
+// Idle CPUs also zero free pages ahead of time into a pool of
+// up to NZERO pages, which kzalloc() hands out for page tables
+// and user memory without clearing them again.
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +23,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "x86.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -17,12 +33,53 @@ struct run {
   struct run *next;
 };
 
+#define KMAG   64    // most pages in a CPU's magazine
+#define KBATCH 32    // pages moved to or from the global list at once
+
+// Aligned so each CPU's magazine has its own cache line.
+struct magazine {
+  struct spinlock lock;   // ordered before kmem.lock
+  struct run *list;
+  int n;
+} __attribute__((aligned(64)));
+
+#define NZERO  256   // most pages kept zeroed in advance
+
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int nfree;              // pages on freelist
+  struct magazine mag[NCPU];
 } kmem;
 
+// References to each physical page, changed atomically.
+static uint pgref[PHYSTOP/PGSIZE];
+#define PGREF(v) pgref[V2P(v)/PGSIZE]
+
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} zpool;
+
+// Take a page from the zeroed pool, or 0 if it is empty. The
+// caller must clear the link word to get an all-zero page.
+static struct run*
+zpop(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.list;
+  if(r){
+    zpool.list = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  return r;
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +88,12 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.mag[i].lock, "kmag");
+  initlock(&zpool.lock, "zpool");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -48,32 +110,94 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    PGREF(p) = 1;
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *t;
+  struct magazine *m;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(atomicadd(&PGREF(v), -1) != 0){
+    if((int)PGREF(v) < 0)
+      panic("kfree ref");
+    return;
+  }
+
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    // Still booting on one CPU; mycpu() may not work yet.
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree++;
+    return;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == KMAG){
+    acquire(&kmem.lock);
+    for(i = 0; i < KBATCH; i++){
+      t = m->list;
+      m->list = t->next;
+      t->next = kmem.freelist;
+      kmem.freelist = t;
+    }
+    kmem.nfree += KBATCH;
     release(&kmem.lock);
+    m->n -= KBATCH;
+  }
+  r->next = m->list;
+  m->list = r;
+  m->n++;
+  release(&m->lock);
+  popcli();
+}
+
+// Take a page from any CPU's magazine, for when this CPU's
+// magazine and the global list are both empty. Magazine locks
+// are taken one at a time, never nested.
+static struct run*
+reclaim(void)
+{
+  struct magazine *m;
+  struct run *r;
+
+  for(m = kmem.mag; m < &kmem.mag[NCPU]; m++){
+    if(m->n == 0)
+      continue;
+    acquire(&m->lock);
+    r = m->list;
+    if(r){
+      m->list = r->next;
+      m->n--;
+    }
+    release(&m->lock);
+    if(r){
+      PGREF(r) = 1;
+      return r;
+    }
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +207,109 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct magazine *m;
 
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+      PGREF(r) = 1;
+    }
+    return (char*)r;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == 0){
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+    while(m->n < KBATCH && (r = kmem.freelist) != 0){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+      r->next = m->list;
+      m->list = r;
+      m->n++;
+    }
     release(&kmem.lock);
+  }
+  r = m->list;
+  if(r){
+    m->list = r->next;
+    m->n--;
+    PGREF(r) = 1;
+  }
+  release(&m->lock);
+  popcli();
+  if(r == 0)
+    r = reclaim();
+  // Out of memory apart from the zeroed pool.
+  if(r == 0)
+    r = zpop();
   return (char*)r;
 }
 
+// Allocate one zero-filled page, from the pool if possible.
+char*
+kzalloc(void)
+{
+  struct run *r;
+  char *v;
+
+  if(kmem.use_lock && (r = zpop()) != 0){
+    r->next = 0;
+    return (char*)r;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Called by the scheduler when it has nothing to run. Zeroes
+// one page into the pool and returns 1, or returns 0 if the
+// pool is full or memory is short.
+int
+kzfill(void)
+{
+  struct run *r;
+
+  if(!kmem.use_lock || zpool.n >= NZERO)
+    return 0;
+  if((r = (struct run*)kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+  acquire(&zpool.lock);
+  r->next = zpool.list;
+  zpool.list = r;
+  zpool.n++;
+  release(&zpool.lock);
+  return 1;
+}
+
+
+// Add a reference to the allocated page at v.
+void
+kref(char *v)
+{
+  atomicadd(&PGREF(v), 1);
+}
+
+// Number of references to the allocated page at v.
+int
+krefs(char *v)
+{
+  return PGREF(v);
+}
+
+// Number of free pages, including magazines and the
+// zeroed pool. Only a snapshot; it is read without locks.
+int
+kfreepages(void)
+{
+  int i, n;
+
+  n = kmem.nfree + zpool.n;
+  for(i = 0; i < NCPU; i++)
+    n += kmem.mag[i].n;
+  return n;
+}
@@ -43,6 +43,15 @@
 
 volatile uint *lapic;  // Initialized in mp.c
 
+uint lapicperus;       // LAPIC timer counts per microsecond
+uint tscperus;         // TSC cycles per microsecond
+uint tscperms;         // TSC cycles per millisecond
+uint64 tscboot;        // TSC at calibration, time 0 of nsuptime()
+static uint lapictick; // LAPIC timer counts per tick
+
+#define PIT_HZ  1193182   // 8253 PIT input clock
+#define CAL_MS  10        // calibration window
+
 //PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -51,6 +60,35 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+// Measure the LAPIC timer and TSC rates against PIT channel 2
+// counting down CAL_MS milliseconds. Leaves the rates 0 if the
+// PIT never finishes.
+static void
+lapiccalibrate(void)
+{
+  uint64 tsc0;
+  uint n, i;
+
+  n = PIT_HZ / 1000 * CAL_MS;
+  outb(0x61, (inb(0x61) & ~0x02) | 0x01);  // gate on, speaker off
+  outb(0x43, 0xB0);                        // channel 2, mode 0
+  outb(0x42, n & 0xFF);
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED);
+  lapicw(TICR, 0xFFFFFFFF);
+  tsc0 = rdtsc();
+  outb(0x42, n >> 8);                      // starts the count
+  for(i = 0; i < 100000000; i++)
+    if(inb(0x61) & 0x20)                   // OUT2 high: done
+      break;
+  if(i == 100000000)
+    return;
+  lapicperus = (0xFFFFFFFF - lapic[TCCR]) / (CAL_MS*1000);
+  tscboot = rdtsc();
+  tscperus = div64(tscboot - tsc0, CAL_MS*1000);
+  tscperms = div64(tscboot - tsc0, CAL_MS);
+}
+
 void
 lapicinit(void)
 {
@@ -62,11 +100,15 @@ lapicinit(void)
 
   // The timer repeatedly counts down at bus frequency
   // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // The boot CPU calibrates TICR for HZ ticks a second,
+  // falling back to a guess without a PIT.
+  if(lapictick == 0){
+    lapiccalibrate();
+    lapictick = lapicperus ? lapicperus * (1000000 / HZ) : 10000000;
+  }
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, lapictick);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -105,6 +147,33 @@ lapicid(void)
   return lapic[ID] >> 24;
 }
 
+// Counts left before this CPU's timer next fires.
+uint
+lapicleft(void)
+{
+  return lapic ? lapic[TCCR] : 0;
+}
+
+// Fire the timer once, n counts from now; see hrsleep().
+void
+lapiconeshot(uint n)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, n);
+}
+
+// Go back to a tick every lapictick counts.
+void
+lapicperiodic(void)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, lapictick);
+}
+
 // Acknowledge interrupt.
 void
 lapiceoi(void)
@@ -113,6 +182,18 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
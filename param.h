@@ -1,6 +1,13 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#ifndef HZ
+#define HZ          100  // timer ticks per second, set with make HZ=n
+#endif
+#if HZ < 10 || HZ > 1000
+#error "HZ must be between 10 and 1000"
+#endif
+#define MSTICKS(ms) (((ms)*HZ + 999) / 1000)  // ticks in ms, rounded up
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
@@ -12,30 +12,125 @@
 #include "buf.h"
 #include "file.h"
 #include "date.h"
+#include "sched.h"
+#include "spawn.h"
 
-#define CYCLE_AGE_LIMIT 8000
-#define INFINITY 9999999
+
+#define NPIDHASH NPROC
+
+// Procs live in slabs: a page holding a struct slab header
+// followed by SLABPROCS procs. Slabs with unused procs are
+// kept ahead of full ones on ptable.slabs.
+struct slab
+{
+  struct slab *next;
+  struct slab *prev;
+  struct proc *free;              // unused procs, through listnext
+  int inuse;
+};
+
+// Sleepers are hashed by chan into FIFO wait queues, so a
+// wakeup only looks at processes that may be sleeping on it.
+#define CHANHASHBITS 7
+#define NCHANHASH (1 << CHANHASHBITS)
+
+struct chanq
+{
+  struct proc *head;              // through channext, oldest first
+  struct proc *tail;
+};
+
+#define SLABPROCS ((PGSIZE - sizeof(struct slab)) / sizeof(struct proc))
+#define SLAB(p) ((struct slab *)PGROUNDDOWN((uint)(p)))
 
 struct
 {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *list;              // allocated procs, through listnext
+  int nproc;                      // procs on list, at most NPROC
+  struct slab *slabs;
+  int nfree;                      // unused procs in all slabs
+  struct proc *pidhash[NPIDHASH]; // chained through pidnext
+  struct chanq chanhash[NCHANHASH];
 } ptable;
 
 static struct proc *initproc;
+static struct spinlock semlock; // protects sems[]
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
-int random(int max);
-void sem_sleep(struct proc* p);
-void sem_wakeup(struct proc* p);
+static void chanremove(struct proc *p);
+
+// Move p to state s, charging the time since its last
+// state change to the state it is leaving.
+// The ptable lock must be held.
+static void
+setstate(struct proc *p, enum procstate s)
+{
+  uint64 now = rdtsc();
+  uint t = ticks;
+
+  switch (p->state)
+  {
+  case RUNNING:
+    p->runtsc += now - p->tsc_stamp;
+    p->last_cpu_time = t;
+    if (s == RUNNABLE)
+    {
+      p->ninvolswitch++;
+      tracesched(TR_PREEMPT, p, p->proc_level);
+    }
+    else if (s == SLEEPING)
+    {
+      p->nvolswitch++;
+      tracesched(TR_SLEEP, p, p->proc_level);
+    }
+    break;
+  case RUNNABLE:
+    p->waittsc += now - p->tsc_stamp;
+    p->waitticks += t - p->tick_stamp;
+    if (s == RUNNING)
+    {
+      p->nrun++;
+      tracesched(TR_DISPATCH, p, p->proc_level);
+    }
+    break;
+  case SLEEPING:
+    p->sleeptsc += now - p->tsc_stamp;
+    p->sleepticks += t - p->tick_stamp;
+    tracesched(TR_WAKEUP, p, p->proc_level);
+    break;
+  case EMBRYO:
+    tracesched(TR_WAKEUP, p, p->proc_level);
+    break;
+  default:
+    break;
+  }
+  p->tsc_stamp = now;
+  p->tick_stamp = t;
+  p->state = s;
+}
+
+// Mark p RUNNABLE and put it on its run queue.
+// The ptable lock must be held.
+static void
+setrunnable(struct proc *p)
+{
+  if (p->state == SLEEPING)
+    chanremove(p);
+  setstate(p, RUNNABLE);
+  rq_add(p);
+}
 
 void pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  initlock(&semlock, "sem");
+  rqinit();
+  traceinit();
 }
 
 // Must be called with interrupts disabled
@@ -89,9 +184,238 @@ int getTime(void)
   return ticks0;
 }
 
+// Pid index: every proc with a pid is on the chain of
+// pidhash[pid % NPIDHASH] from allocproc() until it is freed.
+// The ptable lock must be held.
+static void
+hashpid(struct proc *p)
+{
+  struct proc **h = &ptable.pidhash[p->pid % NPIDHASH];
+
+  p->pidnext = *h;
+  *h = p;
+}
+
+static void
+unhashpid(struct proc *p)
+{
+  struct proc **pp;
+
+  for (pp = &ptable.pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext)
+  {
+    if (*pp == p)
+    {
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->pidnext = 0;
+}
+
+// Return the live proc with the given pid, or 0.
+// The ptable lock must be held.
+static struct proc *
+findproc(int pid)
+{
+  struct proc *p;
+
+  if (pid <= 0)
+    return 0;
+  for (p = ptable.pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if (p->pid == pid && p->state != UNUSED)
+      return p;
+  return 0;
+}
+
+// Child lists: each parent's children are doubly linked
+// through nextsib/prevsib so both adding and removing a
+// child are O(1). The ptable lock must be held.
+static void
+addchild(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->prevsib = 0;
+  p->nextsib = parent->children;
+  if (parent->children)
+    parent->children->prevsib = p;
+  parent->children = p;
+}
+
+static void
+delchild(struct proc *p)
+{
+  if (p->prevsib)
+    p->prevsib->nextsib = p->nextsib;
+  else
+    p->parent->children = p->nextsib;
+  if (p->nextsib)
+    p->nextsib->prevsib = p->prevsib;
+  p->nextsib = p->prevsib = 0;
+  p->parent = 0;
+}
+
+static void
+slabunlink(struct slab *s)
+{
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    ptable.slabs = s->next;
+  if (s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+slabpush(struct slab *s)
+{
+  s->prev = 0;
+  s->next = ptable.slabs;
+  if (ptable.slabs)
+    ptable.slabs->prev = s;
+  ptable.slabs = s;
+}
+
+static void
+slabappend(struct slab *s)
+{
+  struct slab *t;
+
+  s->next = 0;
+  if (ptable.slabs == 0)
+  {
+    s->prev = 0;
+    ptable.slabs = s;
+    return;
+  }
+  for (t = ptable.slabs; t->next; t = t->next)
+    ;
+  t->next = s;
+  s->prev = t;
+}
+
+// Take an unused proc from the first slab, which has one
+// unless every slab is full; then start a new slab.
+// Put the proc on ptable.list. Returns 0 if out of memory.
+// The ptable lock must be held.
+static struct proc *
+procalloc(void)
+{
+  struct slab *s;
+  struct proc *p;
+  int i;
+
+  if ((s = ptable.slabs) == 0 || s->free == 0)
+  {
+    if ((s = (struct slab *)kzalloc()) == 0)
+      return 0;
+    p = (struct proc *)(s + 1);
+    for (i = 0; i < SLABPROCS; i++)
+    {
+      p[i].listnext = s->free;
+      s->free = &p[i];
+    }
+    ptable.nfree += SLABPROCS;
+    slabpush(s);
+  }
+  p = s->free;
+  s->free = p->listnext;
+  s->inuse++;
+  ptable.nfree--;
+  if (s->free == 0 && s->next)
+  {
+    // Full slabs go behind those with room.
+    slabunlink(s);
+    slabappend(s);
+  }
+
+  p->listprev = 0;
+  p->listnext = ptable.list;
+  if (ptable.list)
+    ptable.list->listprev = p;
+  ptable.list = p;
+  ptable.nproc++;
+  return p;
+}
+
+// Take p off ptable.list and return it to its slab. The slab
+// page goes back to kalloc once it is empty, unless it holds
+// the only unused procs left.
+// The ptable lock must be held.
+static void
+procfree(struct proc *p)
+{
+  struct slab *s = SLAB(p);
+
+  if (p->listprev)
+    p->listprev->listnext = p->listnext;
+  else
+    ptable.list = p->listnext;
+  if (p->listnext)
+    p->listnext->listprev = p->listprev;
+  ptable.nproc--;
+
+  p->state = UNUSED;
+  p->listprev = 0;
+  p->listnext = s->free;
+  if (s->free == 0)
+  {
+    // It has room again.
+    slabunlink(s);
+    slabpush(s);
+  }
+  s->free = p;
+  s->inuse--;
+  ptable.nfree++;
+  if (s->inuse == 0 && ptable.nfree > SLABPROCS)
+  {
+    slabunlink(s);
+    ptable.nfree -= SLABPROCS;
+    kfree((char *)s);
+  }
+}
+
+// Wait queue for chan: a multiplicative hash of its address.
+static struct chanq *
+chanq(void *chan)
+{
+  return &ptable.chanhash[((uint)chan * 2654435761U) >> (32 - CHANHASHBITS)];
+}
+
+// Queue the about-to-sleep p behind the others in its bucket.
+// The ptable lock must be held.
+static void
+chanappend(struct proc *p)
+{
+  struct chanq *q = chanq(p->chan);
+
+  p->channext = 0;
+  p->chanprev = q->tail;
+  if (q->tail)
+    q->tail->channext = p;
+  else
+    q->head = p;
+  q->tail = p;
+}
+
+static void
+chanremove(struct proc *p)
+{
+  struct chanq *q = chanq(p->chan);
+
+  if (p->chanprev)
+    p->chanprev->channext = p->channext;
+  else
+    q->head = p->channext;
+  if (p->channext)
+    p->channext->chanprev = p->chanprev;
+  else
+    q->tail = p->chanprev;
+  p->channext = p->chanprev = 0;
+}
+
 // PAGEBREAK: 32
-//  Look in the process table for an UNUSED proc.
-//  If found, change state to EMBRYO and initialize
+//  Take an unused proc from the slab cache.
+//  If there is one, change state to EMBRYO and initialize
 //  state required to run in the kernel.
 //  Otherwise return 0.
 static struct proc *
@@ -102,32 +426,45 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if (ptable.nproc >= NPROC || (p = procalloc()) == 0)
+  {
+    release(&ptable.lock);
+    return 0;
+  }
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
   p->proc_level = 2;
   p->arrival_time = getTime();
-  p->cycles = 1;
-  p->p_ratio = 1;
-  p->t_ratio = 1;
-  p->c_ratio = 1;
-  p->rank = INFINITY;
+  p->cycles = 0;
+  p->n_tickets = DEFAULT_TICKETS;
+  p->pass = 0;
+  p->pass_rq = 0;
+  p->p_ratio = BJF_SCALE;
+  p->t_ratio = BJF_SCALE;
+  p->c_ratio = BJF_SCALE;
+  bjfrank(p);
   p->last_cpu_time = 0;
-  p->wait_cycles = 0;
+  p->runtsc = p->waittsc = p->sleeptsc = 0;
+  p->waitticks = p->sleepticks = 0;
+  p->nrun = p->nvolswitch = p->ninvolswitch = 0;
+  p->cpu = 0;
+  p->affinity = ~0;
+  p->pgid = p->pid;
+  p->gang = 0;
+  p->children = 0;
+  p->systemcalls = 0;
+  hashpid(p);
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if ((p->kstack = kalloc()) == 0)
   {
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    unhashpid(p);
+    procfree(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -181,7 +518,7 @@ void userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&ptable.lock);
 }
@@ -196,8 +533,13 @@ int growproc(int n)
   sz = curproc->sz;
   if (n > 0)
   {
-    if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space; pages are mapped on
+    // first touch by lazyfault(). Refuse to reserve more than
+    // is free right now.
+    if (sz + n < sz || sz + n >= KERNBASE ||
+        (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE > (uint)kfreepages())
       return -1;
+    sz += n;
   }
   else if (n < 0)
   {
@@ -209,6 +551,27 @@ int growproc(int n)
   return 0;
 }
 
+// Give back a process from allocproc() that never ran.
+static void unalloc(struct proc *np)
+{
+  kfree(np->kstack);
+  np->kstack = 0;
+  acquire(&ptable.lock);
+  unhashpid(np);
+  procfree(np);
+  release(&ptable.lock);
+}
+
+// Copy the scheduling state a child inherits from curproc,
+// for fork() and spawn().
+static void inherit(struct proc *np, struct proc *curproc)
+{
+  np->cpu = curproc->cpu;
+  np->affinity = curproc->affinity;
+  np->pgid = curproc->pgid;
+  np->gang = curproc->gang;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -227,13 +590,11 @@ int fork(void)
   // Copy process state from proc.
   if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0)
   {
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    unalloc(np);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
+  inherit(np, curproc);
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -250,7 +611,72 @@ int fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  addchild(curproc, np);
+  setrunnable(np);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a child running the program at path, as fork() then
+// exec() would, but load it straight into a new address space
+// instead of copying the parent's first. The child gets the
+// parent's open files with the n actions in act applied.
+int spawn(char *path, char **argv, struct spawn_action *act, int n)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+  struct file *ofile[NOFILE];
+
+  // Work out the child's files first; nothing to undo if the
+  // actions are bad.
+  for (i = 0; i < NOFILE; i++)
+    ofile[i] = curproc->ofile[i];
+  for (i = 0; i < n; i++)
+  {
+    if (act[i].fd < 0 || act[i].fd >= NOFILE)
+      return -1;
+    switch (act[i].op)
+    {
+    case SPAWN_CLOSE:
+      ofile[act[i].fd] = 0;
+      break;
+    case SPAWN_DUP2:
+      if (ofile[act[i].fd] == 0 || act[i].newfd < 0 || act[i].newfd >= NOFILE)
+        return -1;
+      ofile[act[i].newfd] = ofile[act[i].fd];
+      break;
+    default:
+      return -1;
+    }
+  }
+
+  if ((np = allocproc()) == 0)
+    return -1;
+  // allocproc() leaves the trap frame uninitialized; start
+  // from the parent's for its user segments and flags.
+  *np->tf = *curproc->tf;
+  np->pgdir = 0;
+  if (loadexec(np, path, argv) < 0)
+  {
+    unalloc(np);
+    return -1;
+  }
+  inherit(np, curproc);
+
+  for (i = 0; i < NOFILE; i++)
+    if (ofile[i])
+      np->ofile[i] = filedup(ofile[i]);
+  np->cwd = idup(curproc->cwd);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  addchild(curproc, np);
+  setrunnable(np);
 
   release(&ptable.lock);
 
@@ -287,22 +713,24 @@ void exit(void)
 
   acquire(&ptable.lock);
 
+  // Give back its EDF bandwidth.
+  if (curproc->proc_level == 0)
+    rq_setdeadline(curproc, 0, 0, 0);
+
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  while ((p = curproc->children) != 0)
   {
-    if (p->parent == curproc)
-    {
-      p->parent = initproc;
-      if (p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+    delchild(p);
+    addchild(initproc, p);
+    if (p->state == ZOMBIE)
+      wakeup1(initproc);
   }
 
   // Jump into the scheduler, never to return.
-  curproc->state = ZOMBIE;
+  setstate(curproc, ZOMBIE);
   sched();
   panic("zombie exit");
 }
@@ -318,12 +746,10 @@ int wait(void)
   acquire(&ptable.lock);
   for (;;)
   {
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    for (p = curproc->children; p; p = p->nextsib)
     {
-      if (p->parent != curproc)
-        continue;
       havekids = 1;
       if (p->state == ZOMBIE)
       {
@@ -332,11 +758,12 @@ int wait(void)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
+        delchild(p);
+        unhashpid(p);
         p->pid = 0;
-        p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
-        p->state = UNUSED;
+        procfree(p);
         release(&ptable.lock);
         return pid;
       }
@@ -354,134 +781,18 @@ int wait(void)
   }
 }
 
-struct proc* round_robin_finder(void)
-{
-  struct proc *p;
-  struct proc *best = 0;
-
-  int now = ticks;
-  int max_proc = -100000;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE || p->proc_level != 1)
-        continue;
-      if(now - p->last_cpu_time > max_proc){
-        max_proc = now - p->last_cpu_time;
-        best = p;
-      }
-  }
-  return best;
-}
-
-struct proc *lottery_finder(void)
-{
-  struct proc *p;
-  struct proc *ps[NPROC];
-  int limits[NPROC];
-  int i = 0;
-  int sum = 0;
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == RUNNABLE && p->proc_level == 2)
-    {
-      ps[i] = p;
-      sum += p->n_tickets;
-      limits[i] = sum;
-      i++;
-    }
-  int rnum = random(sum);
-  //cprintf("rand: %d\n", rnum);
-  for (int j = 0; j < i; j++)
-  {
-    if (rnum < limits[j])
-      return ps[j];
-  }
-  return 0;
-}
-
-struct proc *bjf_finder(void)
-{
-  struct proc *p;
-  int best_rank = INFINITY;
-  struct proc* best_proc;  
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == RUNNABLE && p->proc_level == 3) {
-      p ->rank = (p->p_ratio * 3) + (p->t_ratio * p->arrival_time) + (p->c_ratio * p->cycles);
-      if(p->rank < best_rank) {
-        best_rank = p->rank;
-        best_proc = p;
-      }
-    }
-  }
-  if(best_rank != INFINITY) {
-    
-    return best_proc;
-  }
-  return 0;
-}
-
-int find_process(struct proc* q)
+// Halt until an interrupt arrives, unless work showed up.
+// idle is set before the last look at the run queues, and
+// rq_add() checks it after queueing, so a wakeup either is
+// seen here or sends an IPI that ends the hlt.
+static void
+idle(struct cpu *c)
 {
-  struct proc *p, *best = 0;
-
-  // Round Robin
-  int now = ticks;
-  int max_proc = -100000;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state == RUNNABLE && p->proc_level == 1)
-        if(now - p->last_cpu_time > max_proc){
-          max_proc = now - p->last_cpu_time;
-          best = p;
-        }
-  }
-  if(best != 0){
-    q = best;
-    return 0;
-  }
-
-  // Lottery
-  struct proc *ps[NPROC];
-  int limits[NPROC];
-  int i = 0;
-  int sum = 0;
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == RUNNABLE && p->proc_level == 2)
-    {
-      ps[i] = p;
-      sum += p->n_tickets;
-      limits[i] = sum;
-      i++;
-    }
-  int rnum = random(sum);
-  for (int j = 0; j < i; j++)
-  {
-    if (rnum < limits[j]){
-      q = ps[j];
-      /*->c_ratio = j;
-      q->t_ratio = rnum;
-      q->p_ratio = limits[j];*/
-      return 0;
-    }
-  }
-  
-  //BJF
-  int best_rank = INFINITY;
-  struct proc* best_proc;  
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == RUNNABLE && p->proc_level == 3) {
-      p ->rank = (p->p_ratio * 3) + (p->t_ratio * p->arrival_time) + (p->c_ratio * p->cycles);
-      if(p->rank < best_rank) {
-        best_rank = p->rank;
-        best_proc = p;
-      }
-    }
-  }
-  if(best_rank != INFINITY) {
-    q = best_proc;
-    q->rank = best_rank;
-    return 0;
-  }
- 
-  return -1;
+  cli();
+  xchg(&c->idle, 1);
+  if (rq_idle(c - cpus))
+    stihlt();
+  xchg(&c->idle, 0);
 }
 
 // PAGEBREAK: 42
@@ -495,59 +806,50 @@ int find_process(struct proc* q)
 
 void scheduler(void)
 {
-  struct proc *p = 0;
-  struct proc *q;
+  struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
   c->proc = 0;
   for (;;)
   {
     // Enable interrupts on this processor.
     sti();
-    acquire(&ptable.lock);
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    {
-      if (p->state != RUNNABLE)
-        continue;
-      // Aging
-      for (q = ptable.proc; q < &ptable.proc[NPROC]; q++)
-      {
-        if (q->wait_cycles >= CYCLE_AGE_LIMIT && q->state == RUNNABLE)
-        {
-          q->wait_cycles = 0;
-          q->proc_level = 1;
-        }
-        else if (q->state == RUNNABLE && q != p)
-        {
-          q->wait_cycles++;
-        }
-      }
 
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-
-      
-      find_process(p);
-      c->proc = p;
-      
-      switchuvm(p);
-      
-      p->state = RUNNING;
-      p->wait_cycles = 0;
-      p->cycles += 1;
-      swtch(&(c->scheduler), p->context);
-      
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+    // Only this CPU's run queue lock is taken to find work;
+    // ptable.lock is needed just for the switch itself.
+    // With nothing to run, zero pages for kzalloc() one at a
+    // time, rechecking for work between pages, before halting.
+    if ((p = rq_pick(id)) == 0)
+    {
+      if (!kzfill())
+        idle(c);
+      continue;
     }
+    acquire(&ptable.lock);
+    if (p->state != RUNNABLE)
+      panic("scheduler picked");
+
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us.
+    c->proc = p;
+    if (p->cpu != id)
+      c->migrations++;
+    p->cpu = id;
+    switchuvm(p);
+
+    setstate(p, RUNNING);
+    swtch(&(c->scheduler), p->context);
+
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
     release(&ptable.lock);
   }
 }
 
-
 // Enter scheduler.  Must hold only ptable.lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
@@ -577,9 +879,7 @@ void sched(void)
 void yield(void)
 {
   acquire(&ptable.lock); // DOC: yieldlock
-  myproc()->state = RUNNABLE;
-  myproc()->last_cpu_time = ticks;
-  myproc()->cycles += 0.1;
+  setrunnable(myproc());
   sched();
   release(&ptable.lock);
 }
@@ -630,7 +930,8 @@ void sleep(void *chan, struct spinlock *lk)
   }
   // Go to sleep.
   p->chan = chan;
-  p->state = SLEEPING;
+  chanappend(p);
+  setstate(p, SLEEPING);
 
   sched();
 
@@ -651,11 +952,14 @@ void sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for (p = chanq(chan)->head; p; p = next)
+  {
+    next = p->channext;
+    if (p->chan == chan)
+      setrunnable(p);
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -666,6 +970,24 @@ void wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Wake up only the process that has slept longest on chan,
+// for waiters of which just one can make progress.
+void wakeup_one(void *chan)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for (p = chanq(chan)->head; p; p = p->channext)
+  {
+    if (p->chan == chan)
+    {
+      setrunnable(p);
+      break;
+    }
+  }
+  release(&ptable.lock);
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -674,17 +996,14 @@ int kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  if ((p = findproc(pid)) != 0)
   {
-    if (p->pid == pid)
-    {
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if (p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if (p->state == SLEEPING)
+      setrunnable(p);
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -708,10 +1027,8 @@ void procdump(void)
   char *state;
   uint pc[10];
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (p = ptable.list; p; p = p->listnext)
   {
-    if (p->state == UNUSED)
-      continue;
     if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -754,13 +1071,14 @@ void find_callers(int n, int **procs)
   int j = 0;
   int f = 0;
   int temp[64] = {0};
+  struct proc *p;
   acquire(&ptable.lock);
 
-  for (int i = 0; i < sizeof(ptable.proc) / sizeof(ptable.proc[0]); i++)
+  for (p = ptable.list; p && j < NELEM(temp); p = p->listnext)
   {
-    if (ptable.proc[i].systemcalls[n] == 1)
+    if (n >= 0 && n < 64 && (p->systemcalls & ((uint64)1 << n)))
     {
-      temp[j] = ptable.proc[i].pid;
+      temp[j] = p->pid;
       j++;
     }
   }
@@ -786,70 +1104,327 @@ void find_callers(int n, int **procs)
 int change_queue(int pid, int level)
 {
   struct proc *p;
+  int queued;
   if (level < 1 || level > 3)
     return -1;
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  acquire(&ptable.lock);
+  // EDF processes leave level 0 through set_deadline().
+  if ((p = findproc(pid)) != 0 && p->proc_level != 0)
   {
-    if (p->pid == pid)
-    {
-      p->proc_level = level;
-      return 0;
-    }
+    queued = rq_remove(p);
+    p->proc_level = level;
+    bjfrank(p);
+    tracesched(TR_LEVEL, p, level);
+    if (queued)
+      rq_add(p);
+    release(&ptable.lock);
+    return 0;
   }
+  release(&ptable.lock);
   return -1;
 }
 
 int set_tickets(int pid, int count)
 {
   struct proc *p;
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  int queued;
+  if (count < 1 || count > MAX_TICKETS)
+    return -1;
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) != 0)
   {
-    if (p->pid == pid)
-    {
-      p->n_tickets = count;
-      return 0;
-    }
+    queued = rq_remove(p);
+    p->n_tickets = count;
+    if (queued)
+      rq_add(p);
+    release(&ptable.lock);
+    return 0;
   }
+  release(&ptable.lock);
   return -1;
 }
 
 int sys_set_bjf_params(int p_ratio, int t_ratio, int c_ratio)
 {
   struct proc *p;
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  int queued;
+  acquire(&ptable.lock);
+  for (p = ptable.list; p; p = p->listnext)
   {
+    queued = rq_remove(p);
     p->p_ratio = p_ratio;
     p->t_ratio = t_ratio;
     p->c_ratio = c_ratio;
+    bjfrank(p);
+    if (queued)
+      rq_add(p);
   }
+  release(&ptable.lock);
   return 0;
 }
 
 int proc_set_bjf_params(int pid,int p_ratio, int t_ratio, int c_ratio)
 {
   struct proc *p;
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  int queued;
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) != 0)
   {
-    if (p->pid == pid)
+    queued = rq_remove(p);
+    p->p_ratio = p_ratio;
+    p->t_ratio = t_ratio;
+    p->c_ratio = c_ratio;
+    bjfrank(p);
+    if (queued)
+      rq_add(p);
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Restrict process pid to the CPUs whose bits are set in mask.
+// It keeps preferring the CPU it last ran on if that is still
+// allowed. A running process moves when it next yields. An EDF
+// reservation on a CPU mask excludes moves to an allowed one;
+// if none has room, the call fails and nothing changes.
+int set_affinity(int pid, uint mask)
+{
+  struct proc *p;
+  int queued, r;
+  uint old;
+
+  mask &= (1 << ncpu) - 1;
+  if (mask == 0)
+    return -1;
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) != 0)
+  {
+    queued = rq_remove(p);
+    old = p->affinity;
+    p->affinity = mask;
+    r = 0;
+    if (p->proc_level == 0 && !(mask & (1 << p->edf_cpu)))
     {
-      p->p_ratio = p_ratio;
-      p->t_ratio = t_ratio;
-      p->c_ratio = c_ratio;
-      return 0;
+      r = rq_setdeadline(p, p->edf_period, p->edf_runtime, p->edf_deadline);
+      if (r < 0)
+        p->affinity = old;
     }
+    if (queued)
+      rq_add(p);
+    release(&ptable.lock);
+    return r;
   }
+  release(&ptable.lock);
   return -1;
 }
 
-int print_process(void)
+// Give process pid a level-0 EDF reservation of runtime ticks
+// in every period, to be used by deadline ticks into the
+// period. Fails unless the reservation fits on a CPU it may
+// run on. A runtime of 0 drops the reservation and returns pid
+// to the level it had before.
+int set_deadline(int pid, int period, int runtime, int deadline)
+{
+  struct proc *p;
+  int queued, r;
+
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) != 0 && p->state != ZOMBIE)
+  {
+    queued = rq_remove(p);
+    r = rq_setdeadline(p, period, runtime, deadline);
+    bjfrank(p);
+    if (r == 0)
+      tracesched(TR_LEVEL, p, p->proc_level);
+    if (queued)
+      rq_add(p);
+    release(&ptable.lock);
+    return r;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Check a sched_setattr_batch() entry before taking any locks.
+static int attrcheck(struct sched_attr *a)
+{
+  if (a->pid <= 0)
+    return SA_ENOPID;
+  if ((a->flags & SA_LEVEL) && (a->level < 1 || a->level > 3))
+    return SA_EINVAL;
+  if ((a->flags & SA_TICKETS) && (a->tickets < 1 || a->tickets > MAX_TICKETS))
+    return SA_EINVAL;
+  return SA_OK;
+}
+
+// Apply the level, tickets and BJF ratios in a[0..n-1] under
+// one hold of ptable.lock, finding each pid through the pid
+// index. Sets each entry's status and returns the number of
+// entries applied, or -1 if n is more than NPROC.
+int sched_setattr_batch(struct sched_attr *a, int n)
 {
   struct proc *p;
+  struct sched_attr *e;
+  int queued, done;
+
+  if (n > NPROC)
+    return -1;
+  done = 0;
   acquire(&ptable.lock);
-  cprintf("name\t\tpid\tstate\t\tqueue_level\tcycle\ttickets\tarrival\trank\tp_ratio\tt_ratio\tc_ratio\n");
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for (e = a; e < &a[n]; e++)
   {
-    if (p->state == 0)
+    if ((e->status = attrcheck(e)) != SA_OK)
       continue;
+    if ((p = findproc(e->pid)) == 0)
+    {
+      e->status = SA_ENOPID;
+      continue;
+    }
+    if ((e->flags & SA_LEVEL) && p->proc_level == 0)
+    {
+      e->status = SA_EINVAL;
+      continue;
+    }
+    queued = rq_remove(p);
+    if (e->flags & SA_LEVEL)
+    {
+      p->proc_level = e->level;
+      tracesched(TR_LEVEL, p, e->level);
+    }
+    if (e->flags & SA_TICKETS)
+      p->n_tickets = e->tickets;
+    if (e->flags & SA_BJF)
+    {
+      p->p_ratio = e->p_ratio;
+      p->t_ratio = e->t_ratio;
+      p->c_ratio = e->c_ratio;
+    }
+    bjfrank(p);
+    if (queued)
+      rq_add(p);
+    done++;
+  }
+  release(&ptable.lock);
+  return done;
+}
+
+// Move process pid into process group pgid. pid 0 means the
+// caller, and pgid 0 makes pid the leader of a new group.
+// Returns -1 if pid does not exist.
+int setpgid(int pid, int pgid)
+{
+  struct proc *p;
+
+  if (pid == 0)
+    pid = myproc()->pid;
+  if (pgid < 0)
+    return -1;
+  if (pgid == 0)
+    pgid = pid;
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) != 0)
+  {
+    p->pgid = pgid;
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Turn gang scheduling on or off for every member of process
+// group pgid. Children forked later inherit the setting.
+// Returns the number of processes changed.
+int set_gang(int pgid, int on)
+{
+  struct proc *p;
+  int n;
+
+  n = 0;
+  acquire(&ptable.lock);
+  for (p = ptable.list; p; p = p->listnext)
+  {
+    if (p->pgid == pgid)
+    {
+      p->gang = on != 0;
+      n++;
+    }
+  }
+  release(&ptable.lock);
+  return n;
+}
+
+// Copy the CPU accounting of process pid into *st,
+// including the time spent in its current state.
+int getprocstats(int pid, struct procstats *st)
+{
+  struct proc *p;
+  uint64 dtsc;
+  uint dt;
+
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  st->runtsc = p->runtsc;
+  st->waittsc = p->waittsc;
+  st->sleeptsc = p->sleeptsc;
+  st->runticks = p->cycles;
+  st->waitticks = p->waitticks;
+  st->sleepticks = p->sleepticks;
+  st->nrun = p->nrun;
+  st->nvolswitch = p->nvolswitch;
+  st->ninvolswitch = p->ninvolswitch;
+  dtsc = rdtsc() - p->tsc_stamp;
+  dt = ticks - p->tick_stamp;
+  if (p->state == RUNNING)
+    st->runtsc += dtsc;
+  else if (p->state == RUNNABLE)
+  {
+    st->waittsc += dtsc;
+    st->waitticks += dt;
+  }
+  else if (p->state == SLEEPING)
+  {
+    st->sleeptsc += dtsc;
+    st->sleepticks += dt;
+  }
+  release(&ptable.lock);
+  st->runns = tsctons(st->runtsc);
+  st->waitns = tsctons(st->waittsc);
+  st->sleepns = tsctons(st->sleeptsc);
+  return 0;
+}
+
+// Print a BJF fixed-point value, e.g. 150 as 1.50.
+static void
+printfixed(int v)
+{
+  if (v < 0)
+  {
+    cprintf("-");
+    v = -v;
+  }
+  cprintf("%d.%s%d", v / BJF_SCALE, v % BJF_SCALE < 10 ? "0" : "", v % BJF_SCALE);
+}
+
+int print_process(void)
+{
+  struct proc *p;
+  int i;
+  acquire(&ptable.lock);
+  cprintf("quantum: level 1 %d, level 2 %d, level 3 %d ticks\n",
+          rq_quantum(1), rq_quantum(2), rq_quantum(3));
+  for (i = 0; i < ncpu; i++)
+    cprintf("cpu%d: idle %d of %d ticks, %d migrations\n",
+            i, cpus[i].idleticks, cpus[i].ticks, cpus[i].migrations);
+  cprintf("name\t\tpid\tstate\t\tqueue_level\tquantum\tcycle\ttickets\tarrival\trank\tp_ratio\tt_ratio\tc_ratio\n");
+  for (p = ptable.list; p; p = p->listnext)
+  {
     cprintf("%s\t\t", p->name);    
     cprintf("%d\t", p->pid);
     switch (p->state)
@@ -878,121 +1453,108 @@ int print_process(void)
     }
 
     cprintf("%d\t\t", p->proc_level);
+    if (p->proc_level == 0)
+      cprintf("%d/%d\t", p->edf_runtime, p->edf_period);
+    else
+      cprintf("%d\t", rq_quantum(p->proc_level));
     cprintf("%d\t", p->cycles);
     cprintf("%d\t", p->n_tickets);
     cprintf("%d\t", p->arrival_time);
-    cprintf("%d\t", p->rank);
-    cprintf("%d\t", p->p_ratio);
-    cprintf("%d\t", p->t_ratio);
-    cprintf("%d\t\n", p->c_ratio);
+    // Only the display is clamped; see bjfrank().
+    if (p->rank > 0x7fffffff)
+      printfixed(0x7fffffff);
+    else if (p->rank < -0x7fffffff)
+      printfixed(-0x7fffffff);
+    else
+      printfixed(p->rank);
+    cprintf("\t");
+    printfixed(p->p_ratio);
+    cprintf("\t");
+    printfixed(p->t_ratio);
+    cprintf("\t");
+    printfixed(p->c_ratio);
+    cprintf("\t\n");
   }
   release(&ptable.lock);
   return -1;
 }
 
-int random(int max)
+// xorshift draw in [0, max). Works over the full unsigned
+// range so ticket totals beyond 2^16 stay uniform.
+uint random(uint max)
 {
+  static uint z1 = 12345; // 12345 for rest of zx
+  static uint z2 = 12345; // 12345 for rest of zx
+  static uint z3 = 12345; // 12345 for rest of zx
+  static uint z4 = 12345; // 12345 for rest of zx
+  uint b;
 
-  if (max <= 0)
+  if (max == 0)
   {
-    return 1;
+    return 0;
   }
 
-  static int z1 = 12345; // 12345 for rest of zx
-  static int z2 = 12345; // 12345 for rest of zx
-  static int z3 = 12345; // 12345 for rest of zx
-  static int z4 = 12345; // 12345 for rest of zx
-
-  int b;
   b = (((z1 << 6) ^ z1) >> 13);
-  z1 = (((z1 & 4294967294) << 18) ^ b);
+  z1 = (((z1 & 4294967294U) << 18) ^ b);
   b = (((z2 << 2) ^ z2) >> 27);
-  z2 = (((z2 & 4294967288) << 2) ^ b);
+  z2 = (((z2 & 4294967288U) << 2) ^ b);
   b = (((z3 << 13) ^ z3) >> 21);
-  z3 = (((z3 & 4294967280) << 7) ^ b);
+  z3 = (((z3 & 4294967280U) << 7) ^ b);
   b = (((z4 << 3) ^ z4) >> 12);
-  z4 = (((z4 & 4294967168) << 13) ^ b);
-
-  // if we have an argument, then we can use it
-  int rand = ((z1 ^ z2 ^ z3 ^ z4)) % max;
-
-  if (rand < 0)
-  {
-    rand = rand * -1;
-  }
+  z4 = (((z4 & 4294967168U) << 13) ^ b);
 
-  return rand;
+  return (z1 ^ z2 ^ z3 ^ z4) % max;
 }
 
 //------------------------------------------------
 
-#define MAXPROC 100
-
+// Semaphores for the dining philosophers. Waiters sleep on
+// &sems[i]; a release wakes just one of them.
 typedef struct
 {
     int value;
-    struct proc* list[MAXPROC];
-    int last;
 }semaphore;
 
 semaphore sems[6];
 
-void sem_sleep(struct proc *p1)
-{
-  acquire(&ptable.lock); 
-  p1->state = SLEEPING;
-  sched();
-  release(&ptable.lock);
-}
-
-void sem_wakeup(struct proc *p1)
-{
-  acquire(&ptable.lock);
-  p1->state = RUNNABLE;
-  release(&ptable.lock);
-}
-
 int sem_init(int i , int v)
 {
+  acquire(&semlock);
   sems[i].value = v;
-  sems[i].last = 0;
+  release(&semlock);
   return 0;
 }
 
 int sem_acquire(int i)
 {
-  if(sems[i].value <= 0)
-  {
-    struct proc* p = myproc();
-    sems[i].list[sems[i].last ++] = p;
-    sem_sleep(p);
-  }
-  else
-    sems[i].value--;
+  int v;
+  acquire(&semlock);
+  while(sems[i].value <= 0)
+    sleep(&sems[i], &semlock);
+  v = --sems[i].value;
+  release(&semlock);
   if(i != 5)
     cprintf("Philosopher %d ACQUIRED chopstick %d ,with value %d\n",
-           myproc()->pid-3 , i, sems[i].value);
+           myproc()->pid-3 , i, v);
   else cprintf("Philosopher %d is READY to eat, with value %d\n",
-           myproc()->pid-3 , sems[i].value);
+           myproc()->pid-3 , v);
 
   return 0;
 }
 
 int sem_release(int i)
 {
-  if(sems[i].last)
-  {
-    struct proc* p = sems[i].list[--sems[i].last];
-    sem_wakeup(p);
-  }
-  else
-    sems[i].value++;
+  int v;
+  acquire(&semlock);
+  v = ++sems[i].value;
+  wakeup_one(&sems[i]);
+  release(&semlock);
   
   if(i != 5)
     cprintf("Philosopher %d RELEASED chopstick %d ,with value %d\n",
-           myproc()->pid-3 , i, sems[i].value);
+           myproc()->pid-3 , i, v);
   else 
     cprintf("Philosopher %d STOP eating, with value %d\n",
-           myproc()->pid-3, sems[i].value);
+           myproc()->pid-3, v);
   return 0;
 }
@@ -8,6 +8,12 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint idle;          // Halted in scheduler() waiting for work?
+  uint migrations;             // Processes run here that last ran elsewhere
+  uint ticks;                  // Timer ticks taken on this cpu
+  uint idleticks;              // Timer ticks that found it idle
+  int hrstate;                 // LAPIC one-shot state, see hrsleep()
+  uint hrrest;                 // counts left in the tick after the one-shot
 };
 
 extern struct cpu cpus[NCPU];
@@ -49,18 +55,65 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  int systemcalls[21];         // System calls that called in this process
+  uint64 systemcalls;          // bit n set: has made system call n
 
   int proc_level;              // process level
   int arrival_time;            // time of arrival
-  int cycles;                  // cycles
+  int cycles;                  // timer ticks spent running
   int n_tickets;               // num of lottery tickets
-  int wait_cycles;             // waiting cycles
-  int rank;                    // rank = p_ratio * proc_level + t_ratio * arrival_time + c_ratio * cycles
-  int p_ratio;                 // priority ratio
-  int t_ratio;                 // arrival time ratio
-  int c_ratio;                 // executed cycle ratio
-  int last_cpu_time;
+  uint pass;                   // stride pass value
+  struct runqueue *pass_rq;    // run queue pass is relative to
+  uint wait_start;             // ticks when queued or last aged
+  int slice;                   // ticks left in current time slice
+  int64 rank;                  // rank = p_ratio * proc_level + t_ratio * arrival_time + c_ratio * cycles
+  int p_ratio;                 // priority ratio, fixed point (BJF_SCALE)
+  int t_ratio;                 // arrival time ratio, fixed point
+  int c_ratio;                 // executed cycle ratio, fixed point
+  int last_cpu_time;           // ticks when it last stopped running
+
+  // CPU accounting, see setstate() and getprocstats().
+  uint64 tsc_stamp;            // rdtsc() at the last state change
+  uint tick_stamp;             // ticks at the last state change
+  uint64 runtsc;
+  uint64 waittsc;
+  uint64 sleeptsc;
+  uint waitticks;
+  uint sleepticks;
+  uint nrun;
+  uint nvolswitch;
+  uint ninvolswitch;
+
+  int cpu;                     // CPU p last ran on
+  uint affinity;               // bit i set: may run on CPU i
+  struct proc *listnext;       // ptable.list, or slab free list
+  struct proc *listprev;
+  struct proc *pidnext;        // pid hash chain
+  struct proc *channext;       // wait queue of chan, see sleep()
+  struct proc *chanprev;
+  struct proc *children;       // first child
+  struct proc *nextsib;        // parent's child list links
+  struct proc *prevsib;
+  int pgid;                    // process group, inherited across fork
+  int gang;                    // co-schedule with its group, see rq_pick()
+
+  // Level-0 EDF reservation, see rq_setdeadline(). In ticks.
+  int edf_period;
+  int edf_runtime;             // budget per period
+  int edf_deadline;            // relative to the period start
+  int edf_left;                // budget left in this period
+  uint edf_due;                // absolute deadline of this period
+  uint edf_release;            // start of the next period
+  int edf_cpu;                 // CPU whose bandwidth it reserves
+  int edf_oldlevel;            // level to return to on leaving EDF
+  struct runqueue *rq;         // run queue p is on, or 0
+  struct proc *rq_next;        // level-1 run queue links
+  struct proc *rq_prev;
+  struct proc *rq_left;        // run queue tree links, levels 0, 2, 3
+  struct proc *rq_right;
+  struct proc *rq_up;
+  uint rq_sum;                 // lottery tickets in p's subtree
+  struct proc *age_next;       // run queue age list links
+  struct proc *age_prev;
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -3,6 +3,7 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "sched.h"
 
 int main(int argc, char *argv[])
 {
@@ -10,9 +11,9 @@ int main(int argc, char *argv[])
 
     if(argc > 4) {
         pid = atoi(argv[1]);
-        p_ratio = atoi(argv[2]);
-        t_ratio = atoi(argv[3]);
-        c_ratio = atoi(argv[4]);
+        p_ratio = atofix(argv[2], BJF_SCALE);
+        t_ratio = atofix(argv[3], BJF_SCALE);
+        c_ratio = atofix(argv[4], BJF_SCALE);
     }
     else {
         printf(1, "Insufficient inputs\n", sizeof("Insufficient inputs\n"));
@@ -0,0 +1,63 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "sched.h"
+
+// printf has no 64-bit conversion; print by repeated
+// subtraction so no libgcc division helper is needed.
+void
+printu64(uint64 v)
+{
+  uint64 p;
+  int d, started;
+
+  started = 0;
+  for(p = 10000000000000000000ULL; p > 1; p /= 10){
+    for(d = 0; v >= p; d++)
+      v -= p;
+    if(d || started){
+      printf(1, "%d", d);
+      started = 1;
+    }
+  }
+  printf(1, "%d", (int)v);
+}
+
+int main(int argc, char *argv[])
+{
+    struct procstats st;
+    int pid;
+
+    if(argc > 1) {
+        pid = atoi(argv[1]);
+    }
+    else {
+        printf(1, "usage: procstats pid\n");
+        exit();
+    }
+
+    if(getprocstats(pid, &st) < 0) {
+        printf(1, "procstats: no process %d\n", pid);
+        exit();
+    }
+
+    printf(1, "run\t%d ticks\t", st.runticks);
+    printu64(st.runtsc);
+    printf(1, " cycles\t");
+    printu64(st.runns);
+    printf(1, " ns\n");
+    printf(1, "wait\t%d ticks\t", st.waitticks);
+    printu64(st.waittsc);
+    printf(1, " cycles\t");
+    printu64(st.waitns);
+    printf(1, " ns\n");
+    printf(1, "sleep\t%d ticks\t", st.sleepticks);
+    printu64(st.sleeptsc);
+    printf(1, " cycles\t");
+    printu64(st.sleepns);
+    printf(1, " ns\n");
+    printf(1, "dispatched %d, voluntary %d, involuntary %d\n",
+           st.nrun, st.nvolswitch, st.ninvolswitch);
+
+    exit();
+}
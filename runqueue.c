@@ -0,0 +1,1142 @@
+// Per-CPU run queues for the three-level scheduler.
+//
+// Every queued RUNNABLE process sits on one CPU's run queue,
+// on the structure for its proc_level:
+//   level 0: EDF reservations, a min-heap ordered by absolute
+//            deadline, plus a heap ordered by release time for
+//            those throttled until their next period.
+//   level 1: FIFO, served round robin.
+//   level 2: under SCHED_LOTTERY, lottery entrants in a tree
+//            that sums their tickets so a draw is one O(log n)
+//            walk; under SCHED_STRIDE, a min-heap ordered by
+//            stride pass.
+//   level 3: binary min-heap ordered by BJF rank.
+// All processes on a run queue are also kept on its age list
+// in the order they were queued. Each CPU ages its own queue
+// once per timer tick, and only has to look at the list head.
+//
+// Each run queue has its own lock. A process is queued on the
+// CPU it last ran on, so its cache and TLB are likely still
+// warm, unless its affinity mask excludes that CPU. A CPU with
+// nothing to run steals from the busiest queue, taking the
+// process that has waited longest and may run there. Every
+// BALANCE_TICKS each CPU also pulls work from the most loaded
+// queue if it is well above its own; see rq_balance().
+//
+// A level-0 process reserves runtime/deadline of one CPU's
+// bandwidth and always queues there; the total reserved on a
+// CPU never exceeds one, so EDF meets every deadline. It runs
+// ahead of all other levels until its budget for the period is
+// spent, then is throttled until the period ends. Neither
+// stealing nor balancing moves it. See rq_setdeadline().
+//
+// Processes in gang mode are co-scheduled with their process
+// group: when a CPU picks one, it opens a gang window of one
+// time slice and sends the other CPUs an IPI. Until the window
+// closes, every CPU prefers queued members of that group, and
+// running processes outside it yield. See rq_pick().
+//
+// Lock order is ptable.lock, then run queue locks. Only the
+// balancer holds two run queue locks, taken in array order.
+// A picked process is off every queue (p->rq == 0) but still
+// RUNNABLE until the scheduler takes ptable.lock and runs it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sched.h"
+#include "traps.h"
+
+#define AGE_TICKS MSTICKS(1000)    // default wait per promotion
+#define NLEVEL    3
+#define BALANCE_TICKS MSTICKS(100) // between balancer runs on a CPU
+#define IMBALANCE_PCT 25  // busiest must exceed us by this much
+#define LOAD_UNIT 1024    // balancing weight of a level-3 process
+#define STRIDE1 (1 << 22)
+#define EDF_UNIT 1024     // EDF bandwidth of one CPU
+
+struct proctree {
+  struct proc *root;
+  int n;
+  int (*less)(struct proc*, struct proc*);
+};
+
+struct runqueue {
+  struct spinlock lock;
+  int n;                       // queued processes
+  uint load;                   // sum of weight() over queued processes
+  uint balances;               // rq_balance() runs that pulled work
+  uint pulled;                 // processes pulled by rq_balance()
+  struct proc *rr_head;        // level 1
+  struct proc *rr_tail;
+  struct proctree lottery;     // level 2 under SCHED_LOTTERY
+  int policy;                  // level-2 policy, SCHED_LOTTERY or SCHED_STRIDE
+  struct proctree stride;      // level 2 under SCHED_STRIDE
+  uint pass;                   // pass of the last stride pick
+  struct proctree bjf;         // level 3
+  struct proctree edf;         // level 0 with budget left
+  struct proctree throttled;   // level 0 waiting for its next period
+  uint edfbw;                  // EDF bandwidth reserved, under ptable.lock
+  struct proc *age_head;       // all queued processes, oldest first
+  struct proc *age_tail;
+};
+
+static struct runqueue runqueues[NCPU];
+
+// The open gang window, if any.
+static struct {
+  struct spinlock lock;
+  int pgid;                    // group being co-scheduled, or 0
+  uint until;                  // ticks when the window closes
+} gang;
+static uint agelimit = AGE_TICKS;  // 0 turns aging off
+
+// Time slice in ticks for each level: short round-robin
+// turns, longer runs for the lottery and BJF batch levels.
+// The defaults are 10, 40 and 80ms whatever HZ is.
+static int quantum[NLEVEL+1] = { 0, MSTICKS(10), MSTICKS(40), MSTICKS(80) };
+
+static int
+rankless(struct proc *a, struct proc *b)
+{
+  return a->rank < b->rank;
+}
+
+// Pass values wrap; compare by signed distance.
+static int
+passless(struct proc *a, struct proc *b)
+{
+  return (int)(a->pass - b->pass) < 0;
+}
+
+// Tick stamps wrap too.
+static int
+dueless(struct proc *a, struct proc *b)
+{
+  return (int)(a->edf_due - b->edf_due) < 0;
+}
+
+static int
+releaseless(struct proc *a, struct proc *b)
+{
+  return (int)(a->edf_release - b->edf_release) < 0;
+}
+
+void
+rqinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    initlock(&runqueues[i].lock, "runqueue");
+    runqueues[i].policy = SCHED_LOTTERY;
+    runqueues[i].stride.less = passless;
+    runqueues[i].bjf.less = rankless;
+    runqueues[i].edf.less = dueless;
+    runqueues[i].throttled.less = releaseless;
+  }
+  initlock(&gang.lock, "gang");
+}
+
+// A process without tickets still gets a chance in the draw.
+static uint
+tickets(struct proc *p)
+{
+  return p->n_tickets > 0 ? p->n_tickets : 1;
+}
+
+// Balancing weight of a queued process: levels 0 and 1 count
+// four times level 3 and level 2 twice, scaled by its tickets.
+static uint
+weight(struct proc *p)
+{
+  uint t;
+
+  switch(p->proc_level){
+  case 0:
+  case 1:
+    return 4*LOAD_UNIT;
+  case 2:
+    t = tickets(p);
+    if(t > 4*DEFAULT_TICKETS)
+      t = 4*DEFAULT_TICKETS;
+    return 2*LOAD_UNIT*t / DEFAULT_TICKETS;
+  default:
+    return LOAD_UNIT;
+  }
+}
+
+//PAGEBREAK!
+// Every level but 1 keeps its processes in a complete binary
+// tree linked through the procs themselves, so a run queue
+// costs the same however many processes the system allows.
+// Positions are numbered 1..n in level order, so the children
+// of position k are 2k and 2k+1 and the path to k is its bits.
+
+// Return the member at position k.
+static struct proc*
+nodeat(struct proctree *t, int k)
+{
+  struct proc *p;
+  int bit;
+
+  for(bit = 1; bit*2 <= k; bit *= 2)
+    ;
+  p = t->root;
+  for(bit /= 2; bit > 0; bit /= 2)
+    p = (k & bit) ? p->rq_right : p->rq_left;
+  return p;
+}
+
+// Add p at the next free position.
+static void
+append(struct proctree *t, struct proc *p)
+{
+  struct proc *up;
+
+  t->n++;
+  p->rq_left = p->rq_right = 0;
+  if(t->n == 1){
+    p->rq_up = 0;
+    t->root = p;
+    return;
+  }
+  up = nodeat(t, t->n/2);
+  p->rq_up = up;
+  if(t->n & 1)
+    up->rq_right = p;
+  else
+    up->rq_left = p;
+}
+
+// Detach and return the member at the last position.
+// It keeps its rq_up so the caller can fix sums above it.
+static struct proc*
+removelast(struct proctree *t)
+{
+  struct proc *q;
+
+  q = nodeat(t, t->n--);
+  if(q->rq_up == 0)
+    t->root = 0;
+  else if(q->rq_up->rq_left == q)
+    q->rq_up->rq_left = 0;
+  else
+    q->rq_up->rq_right = 0;
+  return q;
+}
+
+// Put q, which is not in t, at p's position in place of p.
+static void
+replace(struct proctree *t, struct proc *p, struct proc *q)
+{
+  q->rq_left = p->rq_left;
+  q->rq_right = p->rq_right;
+  q->rq_up = p->rq_up;
+  if(q->rq_left)
+    q->rq_left->rq_up = q;
+  if(q->rq_right)
+    q->rq_right->rq_up = q;
+  if(q->rq_up == 0)
+    t->root = q;
+  else if(q->rq_up->rq_left == p)
+    q->rq_up->rq_left = q;
+  else
+    q->rq_up->rq_right = q;
+}
+
+// Swap c with its parent.
+static void
+swapup(struct proctree *t, struct proc *c)
+{
+  struct proc *p, *l, *r, *s;
+
+  p = c->rq_up;
+  l = c->rq_left;
+  r = c->rq_right;
+  if(p->rq_left == c){
+    s = p->rq_right;
+    c->rq_left = p;
+    c->rq_right = s;
+  } else {
+    s = p->rq_left;
+    c->rq_left = s;
+    c->rq_right = p;
+  }
+  if(s)
+    s->rq_up = c;
+  p->rq_left = l;
+  p->rq_right = r;
+  if(l)
+    l->rq_up = p;
+  if(r)
+    r->rq_up = p;
+  c->rq_up = p->rq_up;
+  p->rq_up = c;
+  if(c->rq_up == 0)
+    t->root = c;
+  else if(c->rq_up->rq_left == p)
+    c->rq_up->rq_left = c;
+  else
+    c->rq_up->rq_right = c;
+}
+
+//PAGEBREAK!
+// Binary min-heap ordered by t->less, on a proctree.
+// Pushing and removing any member are O(log n).
+static void
+heapup(struct proctree *t, struct proc *p)
+{
+  while(p->rq_up && t->less(p, p->rq_up))
+    swapup(t, p);
+}
+
+static void
+heapdown(struct proctree *t, struct proc *p)
+{
+  struct proc *m;
+
+  for(;;){
+    m = p;
+    if(p->rq_left && t->less(p->rq_left, m))
+      m = p->rq_left;
+    if(p->rq_right && t->less(p->rq_right, m))
+      m = p->rq_right;
+    if(m == p)
+      return;
+    swapup(t, m);
+  }
+}
+
+static void
+heappush(struct proctree *t, struct proc *p)
+{
+  append(t, p);
+  heapup(t, p);
+}
+
+static void
+heapdelete(struct proctree *t, struct proc *p)
+{
+  struct proc *q;
+
+  q = removelast(t);
+  if(q == p)
+    return;
+  replace(t, p, q);
+  heapup(t, q);
+  heapdown(t, q);
+}
+
+// The lottery tree is in no order; instead each member's
+// rq_sum is the tickets in its subtree, so the root holds the
+// total and a draw is one walk down. Recompute sums from p up.
+static void
+sumfix(struct proc *p)
+{
+  for(; p; p = p->rq_up){
+    p->rq_sum = tickets(p);
+    if(p->rq_left)
+      p->rq_sum += p->rq_left->rq_sum;
+    if(p->rq_right)
+      p->rq_sum += p->rq_right->rq_sum;
+  }
+}
+
+static void
+lotterypush(struct proctree *t, struct proc *p)
+{
+  append(t, p);
+  sumfix(p);
+}
+
+static void
+lotterydelete(struct proctree *t, struct proc *p)
+{
+  struct proc *q;
+
+  q = removelast(t);
+  sumfix(q->rq_up);
+  if(q == p)
+    return;
+  replace(t, p, q);
+  sumfix(q);
+}
+
+// Return the member holding ticket r of t's total: in level
+// order, the first whose tickets take the running sum past r.
+static struct proc*
+lotteryfind(struct proctree *t, uint r)
+{
+  struct proc *p;
+  uint l;
+
+  p = t->root;
+  for(;;){
+    l = p->rq_left ? p->rq_left->rq_sum : 0;
+    if(r < l){
+      p = p->rq_left;
+      continue;
+    }
+    r -= l;
+    if(r < tickets(p))
+      return p;
+    r -= tickets(p);
+    p = p->rq_right;
+  }
+}
+
+// Recompute p's BJF rank. Called whenever one of its inputs
+// changes, so the level-3 heap never has to recompute ranks.
+// The ratios are fixed point, so rank is too; it is 64-bit
+// because ratio * arrival_time overflows an int within hours.
+// A queued p must be taken off its queue first.
+void
+bjfrank(struct proc *p)
+{
+  p->rank = (int64)p->p_ratio * p->proc_level +
+            (int64)p->t_ratio * p->arrival_time +
+            (int64)p->c_ratio * p->cycles;
+}
+
+//PAGEBREAK!
+// Put p on the queue of its level.
+static void
+levelinsert(struct runqueue *rq, struct proc *p)
+{
+  rq->load += weight(p);
+  switch(p->proc_level){
+  case 0:
+    if(p->edf_left > 0)
+      heappush(&rq->edf, p);
+    else
+      heappush(&rq->throttled, p);
+    break;
+  case 1:
+    p->rq_next = 0;
+    p->rq_prev = rq->rr_tail;
+    if(rq->rr_tail)
+      rq->rr_tail->rq_next = p;
+    else
+      rq->rr_head = p;
+    rq->rr_tail = p;
+    break;
+  case 2:
+    if(rq->policy == SCHED_STRIDE){
+      // A pass from another queue means nothing against this
+      // one's, so a migrated process starts level with its
+      // front. Nor may a process bank credit while it was away.
+      if(p->pass_rq != rq){
+        p->pass = rq->stride.n > 0 ? rq->stride.root->pass : rq->pass;
+        p->pass_rq = rq;
+      } else if((int)(p->pass - rq->pass) < 0)
+        p->pass = rq->pass;
+      heappush(&rq->stride, p);
+      break;
+    }
+    lotterypush(&rq->lottery, p);
+    break;
+  case 3:
+    heappush(&rq->bjf, p);
+    break;
+  default:
+    panic("levelinsert");
+  }
+}
+
+// Take p off the queue of its level.
+static void
+leveldelete(struct runqueue *rq, struct proc *p)
+{
+  rq->load -= weight(p);
+  switch(p->proc_level){
+  case 0:
+    if(p->edf_left > 0)
+      heapdelete(&rq->edf, p);
+    else
+      heapdelete(&rq->throttled, p);
+    break;
+  case 1:
+    if(p->rq_prev)
+      p->rq_prev->rq_next = p->rq_next;
+    else
+      rq->rr_head = p->rq_next;
+    if(p->rq_next)
+      p->rq_next->rq_prev = p->rq_prev;
+    else
+      rq->rr_tail = p->rq_prev;
+    p->rq_next = p->rq_prev = 0;
+    break;
+  case 2:
+    if(rq->policy == SCHED_STRIDE){
+      heapdelete(&rq->stride, p);
+      break;
+    }
+    lotterydelete(&rq->lottery, p);
+    break;
+  case 3:
+    heapdelete(&rq->bjf, p);
+    break;
+  default:
+    panic("leveldelete");
+  }
+}
+
+static void
+ageappend(struct runqueue *rq, struct proc *p)
+{
+  p->wait_start = ticks;
+  p->age_next = 0;
+  p->age_prev = rq->age_tail;
+  if(rq->age_tail)
+    rq->age_tail->age_next = p;
+  else
+    rq->age_head = p;
+  rq->age_tail = p;
+}
+
+static void
+ageunlink(struct runqueue *rq, struct proc *p)
+{
+  if(p->age_prev)
+    p->age_prev->age_next = p->age_next;
+  else
+    rq->age_head = p->age_next;
+  if(p->age_next)
+    p->age_next->age_prev = p->age_prev;
+  else
+    rq->age_tail = p->age_prev;
+  p->age_next = p->age_prev = 0;
+}
+
+// Start a new EDF period for p at now, with a full budget.
+static void
+edfperiod(struct proc *p, uint now)
+{
+  p->edf_left = p->edf_runtime;
+  p->edf_due = now + p->edf_deadline;
+  p->edf_release = now + p->edf_period;
+}
+
+static void
+enqueue(struct runqueue *rq, struct proc *p)
+{
+  // A reservation woken after its period ended starts a new one.
+  if(p->proc_level == 0 && (int)(ticks - p->edf_release) >= 0)
+    edfperiod(p, ticks);
+  levelinsert(rq, p);
+  ageappend(rq, p);
+  p->rq = rq;
+  rq->n++;
+}
+
+static void
+dequeue(struct runqueue *rq, struct proc *p)
+{
+  ageunlink(rq, p);
+  leveldelete(rq, p);
+  p->rq = 0;
+  rq->n--;
+}
+
+// Dequeue and return the process rq should run next: the
+// earliest EDF deadline, else level 1 in FIFO order, else the
+// level-2 lottery winner or lowest pass, else the lowest BJF
+// rank in level 3. Throttled EDF processes are not eligible.
+// Returns 0 if rq has nothing eligible.
+static struct proc*
+pick(struct runqueue *rq)
+{
+  struct proc *p;
+
+  if(rq->edf.n > 0)
+    p = rq->edf.root;
+  else if(rq->rr_head)
+    p = rq->rr_head;
+  else if(rq->lottery.n > 0)
+    p = lotteryfind(&rq->lottery, random(rq->lottery.root->rq_sum));
+  else if(rq->stride.n > 0){
+    p = rq->stride.root;
+    rq->pass = p->pass;
+    p->pass += STRIDE1 / tickets(p);
+  } else if(rq->bjf.n > 0)
+    p = rq->bjf.root;
+  else
+    return 0;
+
+  dequeue(rq, p);
+  return p;
+}
+
+// Whether queued p may move to cpu. EDF reservations stay on
+// the CPU they were admitted to.
+static int
+stealable(struct proc *p, int cpu)
+{
+  return p->proc_level != 0 && (p->affinity & (1 << cpu));
+}
+
+// Dequeue and return the process on rq that has waited longest
+// among those allowed on cpu, or 0 if there is none.
+static struct proc*
+steal(struct runqueue *rq, int cpu)
+{
+  struct proc *p;
+
+  for(p = rq->age_head; p; p = p->age_next){
+    if(stealable(p, cpu)){
+      dequeue(rq, p);
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Lowest level number with a queued process, or NLEVEL+1.
+// Callers read it without rq->lock as a hint.
+static int
+toplevel(struct runqueue *rq)
+{
+  if(rq->edf.n > 0)
+    return 0;
+  if(rq->rr_head)
+    return 1;
+  if(rq->lottery.n > 0 || rq->stride.n > 0)
+    return 2;
+  if(rq->bjf.n > 0)
+    return 3;
+  return NLEVEL+1;
+}
+
+//PAGEBREAK!
+// The CPU whose queue p should join: the one holding its EDF
+// reservation, which set_affinity() keeps allowed, else the one
+// it last ran on if its affinity allows, else the first allowed.
+static int
+target(struct proc *p)
+{
+  int i;
+
+  if(p->proc_level == 0)
+    return p->edf_cpu;
+  if(p->affinity & (1 << p->cpu))
+    return p->cpu;
+  for(i = 0; i < ncpu; i++)
+    if(p->affinity & (1 << i))
+      return i;
+  return p->cpu;
+}
+
+// Wake a halted CPU to run p, just queued on cpu: cpu itself
+// if it is idle, else any idle CPU p may run on, which will
+// steal it. Pairs with the check in rq_idle(); release() has
+// already fenced the enqueue before the reads of idle here.
+static void
+kick(struct proc *p, int cpu)
+{
+  struct cpu *c, *self;
+
+  self = mycpu();
+  if(cpus[cpu].idle){
+    if(&cpus[cpu] != self)
+      lapicipi(cpus[cpu].apicid, T_IRQ0 + IRQ_WAKEUP);
+    return;
+  }
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c != self && c->idle && (p->affinity & (1 << (c - cpus)))){
+      lapicipi(c->apicid, T_IRQ0 + IRQ_WAKEUP);
+      return;
+    }
+  }
+}
+
+// Queue p, which has just become RUNNABLE, on the
+// run queue chosen by target().
+// Caller must hold ptable.lock.
+void
+rq_add(struct proc *p)
+{
+  int cpu = target(p);
+  struct runqueue *rq = &runqueues[cpu];
+
+  acquire(&rq->lock);
+  enqueue(rq, p);
+  release(&rq->lock);
+  kick(p, cpu);
+}
+
+// Dequeue p so it can't be picked, e.g. before changing its
+// level, tickets or ratios. Returns 1 if p was queued and 0 if
+// a scheduler has already picked it. Caller must hold ptable.lock.
+int
+rq_remove(struct proc *p)
+{
+  struct runqueue *rq;
+
+  for(;;){
+    if((rq = p->rq) == 0)
+      return 0;
+    acquire(&rq->lock);
+    if(p->rq == rq)
+      break;
+    release(&rq->lock);
+  }
+  dequeue(rq, p);
+  release(&rq->lock);
+  return 1;
+}
+
+// Return 1 if nothing cpu could run now is queued: nothing
+// eligible on its own queue and nothing steal() would give it
+// from another. Throttled EDF processes wait for a timer tick
+// anyway. The unlocked reads of n pair with kick().
+int
+rq_idle(int cpu)
+{
+  struct runqueue *rq;
+  struct proc *p;
+  int i;
+
+  for(i = 0; i < ncpu; i++){
+    rq = &runqueues[i];
+    if(rq->n <= rq->throttled.n)
+      continue;
+    if(i == cpu)
+      return 0;
+    acquire(&rq->lock);
+    for(p = rq->age_head; p; p = p->age_next)
+      if(stealable(p, cpu))
+        break;
+    release(&rq->lock);
+    if(p)
+      return 0;
+  }
+  return 1;
+}
+
+//PAGEBREAK!
+// Return the group of the open gang window, or 0.
+// Reads without gang.lock, so the answer is only a hint.
+static int
+gangactive(void)
+{
+  int pgid = gang.pgid;
+
+  if(pgid == 0 || (int)(ticks - gang.until) >= 0)
+    return 0;
+  return pgid;
+}
+
+// Dequeue and return a queued member of the open gang that may
+// run on cpu, looking at cpu's own queue first.
+// Returns 0 if there is no gang window or no such member.
+static struct proc*
+gangpick(int cpu)
+{
+  struct runqueue *rq;
+  struct proc *p;
+  int i, pgid;
+
+  if((pgid = gangactive()) == 0)
+    return 0;
+  for(i = 0; i < ncpu; i++){
+    rq = &runqueues[(cpu + i) % ncpu];
+    if(rq->n == 0)
+      continue;
+    acquire(&rq->lock);
+    for(p = rq->age_head; p; p = p->age_next){
+      if(p->pgid == pgid && p->proc_level != 0 && (p->affinity & (1 << cpu))){
+        dequeue(rq, p);
+        release(&rq->lock);
+        return p;
+      }
+    }
+    release(&rq->lock);
+  }
+  return 0;
+}
+
+// Bitmask of the CPUs that gangpick() could give a queued
+// member of group pgid to.
+static uint
+gangcpus(int pgid)
+{
+  struct runqueue *rq;
+  struct proc *p;
+  uint mask;
+
+  mask = 0;
+  for(rq = runqueues; rq < &runqueues[ncpu]; rq++){
+    if(rq->n == 0)
+      continue;
+    acquire(&rq->lock);
+    for(p = rq->age_head; p; p = p->age_next)
+      if(p->pgid == pgid && p->proc_level != 0)
+        mask |= p->affinity;
+    release(&rq->lock);
+  }
+  return mask;
+}
+
+// cpu is about to run gang member p. Unless a window is already
+// open, open one for p's group lasting p's slice and make the
+// other CPUs that could run one of its queued members
+// reschedule to pick it up.
+static void
+gangstart(struct proc *p, int cpu)
+{
+  int i;
+  uint mask;
+
+  acquire(&gang.lock);
+  if(gangactive()){
+    release(&gang.lock);
+    return;
+  }
+  gang.pgid = p->pgid;
+  gang.until = ticks + p->slice;
+  release(&gang.lock);
+  mask = gangcpus(p->pgid);
+  // No interrupts: a handler's kick() could clobber the ICR.
+  pushcli();
+  for(i = 0; i < ncpu; i++)
+    if(i != cpu && (mask & (1 << i)))
+      lapicipi(cpus[i].apicid, T_IRQ0 + IRQ_RESCHED);
+  popcli();
+}
+
+// Called on an IRQ_RESCHED IPI. Returns 1 if the running
+// process p should yield to the open gang window, which has a
+// queued member this CPU could run instead. EDF reservations
+// never yield to a gang.
+int
+rq_gangpreempt(struct proc *p)
+{
+  int pgid = gangactive();
+
+  if(pgid == 0 || p->pgid == pgid || p->proc_level == 0)
+    return 0;
+  return (gangcpus(pgid) >> cpuid()) & 1;
+}
+
+// Dequeue and return the next process for CPU cpu to run,
+// stealing from the busiest other queue if its own is empty,
+// and start its time slice. Admitted EDF reservations come
+// first; then, while a gang window is open, members of that
+// gang.
+// Returns 0 if there is nothing to run anywhere.
+struct proc*
+rq_pick(int cpu)
+{
+  struct runqueue *rq, *busiest;
+  struct proc *p;
+  int i;
+
+  rq = &runqueues[cpu];
+  p = 0;
+  if(rq->edf.n > 0){
+    acquire(&rq->lock);
+    if(rq->edf.n > 0)
+      p = pick(rq);
+    release(&rq->lock);
+  }
+  if(p == 0 && (p = gangpick(cpu)) != 0){
+    p->slice = quantum[p->proc_level];
+    return p;
+  }
+
+  if(p == 0){
+    acquire(&rq->lock);
+    p = pick(rq);
+    release(&rq->lock);
+  }
+
+  if(p == 0){
+    // The unlocked reads of n only choose a victim.
+    busiest = 0;
+    for(i = 0; i < ncpu; i++){
+      if(i != cpu && runqueues[i].n > 0 && (busiest == 0 || runqueues[i].n > busiest->n))
+        busiest = &runqueues[i];
+    }
+    if(busiest == 0)
+      return 0;
+    acquire(&busiest->lock);
+    p = steal(busiest, cpu);
+    release(&busiest->lock);
+    if(p == 0)
+      return 0;
+  }
+  p->slice = quantum[p->proc_level];
+  if(p->gang)
+    gangstart(p, cpu);
+  return p;
+}
+
+// Switch level 2 of every run queue to policy,
+// moving the queued level-2 processes across.
+int
+rq_setpolicy(int policy)
+{
+  struct runqueue *rq;
+  struct proc *p;
+
+  if(policy != SCHED_LOTTERY && policy != SCHED_STRIDE)
+    return -1;
+  for(rq = runqueues; rq < &runqueues[NCPU]; rq++){
+    acquire(&rq->lock);
+    if(rq->policy != policy){
+      for(p = rq->age_head; p; p = p->age_next)
+        if(p->proc_level == 2)
+          leveldelete(rq, p);
+      rq->policy = policy;
+      for(p = rq->age_head; p; p = p->age_next)
+        if(p->proc_level == 2)
+          levelinsert(rq, p);
+    }
+    release(&rq->lock);
+  }
+  return 0;
+}
+
+// Called by each CPU on every timer tick. Move every process
+// that has waited agelimit ticks on this CPU's queue up one
+// level, so level 3 reaches level 1 in two steps.
+void
+rq_age(int cpu)
+{
+  struct runqueue *rq = &runqueues[cpu];
+  struct proc *p;
+  uint now;
+
+  if(agelimit == 0)
+    return;
+  now = ticks;
+  acquire(&rq->lock);
+  while((p = rq->age_head) != 0 && now - p->wait_start >= agelimit){
+    ageunlink(rq, p);
+    if(p->proc_level > 1){
+      leveldelete(rq, p);
+      p->proc_level--;
+      bjfrank(p);
+      tracesched(TR_LEVEL, p, p->proc_level);
+      levelinsert(rq, p);
+    }
+    ageappend(rq, p);
+  }
+  release(&rq->lock);
+}
+
+// Set the ticks a process waits before aging promotes it;
+// 0 disables aging.
+int
+rq_setagelimit(int n)
+{
+  if(n < 0)
+    return -1;
+  agelimit = n;
+  return 0;
+}
+
+// Charge the running process p one timer tick, which also
+// feeds its BJF rank. Returns 1 if p should yield: its slice
+// is used up or a process of a higher level is waiting on this
+// CPU. An EDF process yields when its budget is spent, and is
+// then throttled by enqueue(), or to an earlier deadline.
+int
+rq_tick(struct proc *p)
+{
+  struct runqueue *rq = &runqueues[p->cpu];
+  int preempt;
+
+  p->cycles++;
+  bjfrank(p);
+  if(p->proc_level == 0){
+    if((int)(ticks - p->edf_release) >= 0)
+      edfperiod(p, ticks);
+    if(--p->edf_left <= 0)
+      return 1;
+    acquire(&rq->lock);
+    preempt = rq->edf.n > 0 && dueless(rq->edf.root, p);
+    release(&rq->lock);
+    return preempt;
+  }
+  if(--p->slice <= 0)
+    return 1;
+  return toplevel(rq) < p->proc_level;
+}
+
+// Called by each CPU on every timer tick. Move throttled EDF
+// processes whose next period has begun back to the EDF heap
+// with a fresh budget.
+void
+rq_replenish(int cpu)
+{
+  struct runqueue *rq = &runqueues[cpu];
+  struct proc *p;
+
+  if(rq->throttled.n == 0)
+    return;
+  acquire(&rq->lock);
+  while(rq->throttled.n > 0){
+    p = rq->throttled.root;
+    if((int)(ticks - p->edf_release) < 0)
+      break;
+    leveldelete(rq, p);
+    edfperiod(p, p->edf_release);
+    levelinsert(rq, p);
+  }
+  release(&rq->lock);
+}
+
+// Bandwidth reserved by runtime ticks every deadline ticks,
+// rounded up so rounding never admits too much.
+static uint
+edfshare(int runtime, int deadline)
+{
+  return (runtime*EDF_UNIT + deadline - 1) / deadline;
+}
+
+// Make p an EDF process with the given reservation, placed on
+// the allowed CPU with the least EDF bandwidth reserved that
+// still has room for runtime/deadline of it. A runtime of 0
+// drops p's reservation. Returns -1 if the parameters are
+// invalid or no CPU has room; p keeps its old reservation.
+// Caller must hold ptable.lock, and p must not be queued.
+int
+rq_setdeadline(struct proc *p, int period, int runtime, int deadline)
+{
+  uint bw;
+  int i, cpu;
+
+  if(runtime == 0){
+    if(p->proc_level == 0){
+      runqueues[p->edf_cpu].edfbw -= edfshare(p->edf_runtime, p->edf_deadline);
+      p->proc_level = p->edf_oldlevel;
+    }
+    return 0;
+  }
+  if(runtime < 0 || deadline < runtime || period < deadline || period > EDF_MAXPERIOD)
+    return -1;
+
+  if(p->proc_level == 0)
+    runqueues[p->edf_cpu].edfbw -= edfshare(p->edf_runtime, p->edf_deadline);
+  bw = edfshare(runtime, deadline);
+  cpu = -1;
+  for(i = 0; i < ncpu; i++){
+    if((p->affinity & (1 << i)) && runqueues[i].edfbw + bw <= EDF_UNIT &&
+       (cpu < 0 || runqueues[i].edfbw < runqueues[cpu].edfbw))
+      cpu = i;
+  }
+  if(cpu < 0){
+    if(p->proc_level == 0)
+      runqueues[p->edf_cpu].edfbw += edfshare(p->edf_runtime, p->edf_deadline);
+    return -1;
+  }
+
+  if(p->proc_level != 0)
+    p->edf_oldlevel = p->proc_level;
+  p->proc_level = 0;
+  p->edf_period = period;
+  p->edf_runtime = runtime;
+  p->edf_deadline = deadline;
+  p->edf_cpu = cpu;
+  runqueues[cpu].edfbw += bw;
+  edfperiod(p, ticks);
+  return 0;
+}
+
+int
+rq_quantum(int level)
+{
+  if(level < 1 || level > NLEVEL)
+    return -1;
+  return quantum[level];
+}
+
+int
+rq_setquantum(int level, int n)
+{
+  if(level < 1 || level > NLEVEL || n < 1)
+    return -1;
+  quantum[level] = n;
+  return 0;
+}
+
+// Called by each CPU on every timer tick; every BALANCE_TICKS
+// pull work from the most loaded run queue. Nothing moves
+// unless that queue's load is IMBALANCE_PCT above ours, and a
+// process only moves if that leaves the two no further apart
+// the other way, so work does not bounce between CPUs.
+void
+rq_balance(int cpu)
+{
+  struct runqueue *rq, *busiest;
+  struct proc *p, *next;
+  uint diff, w;
+  int i, moved;
+
+  if(cpus[cpu].ticks % BALANCE_TICKS != 0)
+    return;
+  rq = &runqueues[cpu];
+  busiest = 0;
+  for(i = 0; i < ncpu; i++)
+    if(i != cpu && (busiest == 0 || runqueues[i].load > busiest->load))
+      busiest = &runqueues[i];
+  // Unlocked reads; rechecked below.
+  if(busiest == 0 || busiest->load * 100 <= rq->load * (100 + IMBALANCE_PCT))
+    return;
+
+  if(rq < busiest){
+    acquire(&rq->lock);
+    acquire(&busiest->lock);
+  } else {
+    acquire(&busiest->lock);
+    acquire(&rq->lock);
+  }
+  moved = 0;
+  if(busiest->load * 100 > rq->load * (100 + IMBALANCE_PCT)){
+    diff = busiest->load - rq->load;
+    for(p = busiest->age_head; p; p = next){
+      next = p->age_next;
+      w = weight(p);
+      if(p->proc_level == 0 || (p->affinity & (1 << cpu)) == 0 || 2*w > diff)
+        continue;
+      dequeue(busiest, p);
+      enqueue(rq, p);
+      diff -= 2*w;
+      moved++;
+    }
+  }
+  if(moved){
+    rq->balances++;
+    rq->pulled += moved;
+  }
+  release(&busiest->lock);
+  release(&rq->lock);
+}
+
+// Copy the balancing counters of up to n CPUs into st.
+// Returns the number of CPUs copied.
+int
+rq_balancestats(struct balancestat *st, int n)
+{
+  struct runqueue *rq;
+  int i;
+
+  for(i = 0; i < n && i < ncpu; i++){
+    rq = &runqueues[i];
+    acquire(&rq->lock);
+    st[i].load = rq->load;
+    st[i].nqueued = rq->n;
+    st[i].balances = rq->balances;
+    st[i].pulled = rq->pulled;
+    st[i].migrations = cpus[i].migrations;
+    release(&rq->lock);
+  }
+  return i;
+}
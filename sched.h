@@ -0,0 +1,73 @@
+#define DEFAULT_TICKETS 10        // lottery tickets of a new process
+#define MAX_TICKETS     (1 << 19) // NPROC of these must sum within a uint
+
+// Level-0 EDF reservations, see set_deadline(). In ticks.
+#define EDF_MAXPERIOD  (1 << 20)
+
+// One entry of sched_setattr_batch(). Only the fields selected
+// by flags are changed; the kernel fills in status.
+#define SA_LEVEL     1
+#define SA_TICKETS   2
+#define SA_BJF       4  // p_ratio, t_ratio and c_ratio
+
+#define SA_OK        0
+#define SA_ENOPID   -1  // no such process
+#define SA_EINVAL   -2  // bad value, or a level change of an EDF process
+
+struct sched_attr {
+  int pid;
+  int flags;          // SA_LEVEL | SA_TICKETS | SA_BJF
+  int level;          // 1..3
+  int tickets;        // 1..MAX_TICKETS
+  int p_ratio;        // BJF ratios, fixed point (BJF_SCALE)
+  int t_ratio;
+  int c_ratio;
+  int status;         // SA_OK or SA_E*
+};
+
+// Level-2 scheduling policies, see set_level2_policy().
+#define SCHED_LOTTERY  0  // random draw weighted by tickets
+#define SCHED_STRIDE   1  // lowest pass first, stride = STRIDE1/tickets
+
+// Per-process CPU accounting, see getprocstats().
+struct procstats {
+  uint64 runtsc;      // TSC cycles spent running
+  uint64 waittsc;     // TSC cycles RUNNABLE, waiting for a CPU
+  uint64 sleeptsc;    // TSC cycles SLEEPING
+  uint runticks;      // timer ticks charged while running
+  uint waitticks;     // ticks RUNNABLE
+  uint sleepticks;    // ticks SLEEPING
+  uint64 runns;       // the three TSC totals in nanoseconds
+  uint64 waitns;
+  uint64 sleepns;
+  uint nrun;          // times dispatched
+  uint nvolswitch;    // gave up the CPU to sleep
+  uint ninvolswitch;  // preempted at the end of a time slice
+};
+
+// Scheduler trace events, see traceread().
+#define TR_WAKEUP    1  // became RUNNABLE after sleeping or fork
+#define TR_PREEMPT   2  // went back to RUNNABLE at the end of a slice
+#define TR_DISPATCH  3  // started running
+#define TR_SLEEP     4  // went to sleep
+#define TR_LEVEL     5  // moved to another queue level
+
+struct traceevent {
+  uint64 tsc;         // rdtsc() on the recording CPU
+  int pid;
+  uchar type;         // TR_*
+  uchar level;        // queue level, the new one for TR_LEVEL
+  uchar cpu;
+};
+
+// Per-CPU load balancing counters, see getbalancestats().
+struct balancestat {
+  uint load;          // weighted load of the CPU's run queue
+  uint nqueued;       // processes on the run queue
+  uint balances;      // balancer runs that pulled work here
+  uint pulled;        // processes pulled from other CPUs
+  uint migrations;    // processes run here that last ran elsewhere
+};
+
+// BJF ratios are fixed point with two decimals: 150 means 1.50.
+#define BJF_SCALE    100
@@ -0,0 +1,91 @@
+// Drain the kernel scheduler trace and print log2 histograms
+// of run-queue latency, from becoming RUNNABLE to running,
+// for each queue level, EDF level 0 included.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "sched.h"
+#include "date.h"
+
+#define NLEVEL  3
+#define NBUCKET 40
+#define NSLOT   1024  // pids tracked, by pid % NSLOT
+#define NEV     256
+
+struct traceevent ev[NEV];
+uint64 queued[NSLOT];   // tsc when pid became RUNNABLE, or 0
+uint hist[NLEVEL+1][NBUCKET];
+
+int
+ilog2(uint64 v)
+{
+  int n;
+
+  for(n = 0; v > 1 && n < NBUCKET-1; n++)
+    v >>= 1;
+  return n;
+}
+
+void
+account(struct traceevent *e)
+{
+  int slot = e->pid % NSLOT;
+
+  switch(e->type){
+  case TR_WAKEUP:
+  case TR_PREEMPT:
+    queued[slot] = e->tsc;
+    break;
+  case TR_DISPATCH:
+    // Events from different CPUs may arrive out of order.
+    if(queued[slot] && e->tsc >= queued[slot] && e->level <= NLEVEL)
+      hist[e->level][ilog2(e->tsc - queued[slot])]++;
+    queued[slot] = 0;
+    break;
+  }
+}
+
+// Milliseconds since boot on the monotonic clock, which does
+// not depend on HZ.
+int
+now(void)
+{
+  struct timespec ts;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0){
+    printf(2, "schedlat: clock_gettime failed\n");
+    exit();
+  }
+  return ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int secs, i, n, level, end;
+  struct timespec poll;
+
+  secs = 5;
+  if(argc > 1)
+    secs = atoi(argv[1]);
+
+  printf(1, "schedlat: tracing for %d seconds\n", secs);
+  end = now() + secs*1000;
+  while(now() < end){
+    while((n = traceread(ev, NEV)) > 0)
+      for(i = 0; i < n; i++)
+        account(&ev[i]);
+    poll.tv_sec = 0;
+    poll.tv_nsec = 100000000;
+    nanosleep(&poll);
+  }
+
+  for(level = 0; level <= NLEVEL; level++){
+    printf(1, "level %d run-queue latency (TSC cycles):\n", level);
+    for(i = 0; i < NBUCKET; i++)
+      if(hist[level][i])
+        printf(1, "  2^%d\t%d\n", i, hist[level][i]);
+  }
+  exit();
+}
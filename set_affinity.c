@@ -0,0 +1,24 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+int main(int argc, char *argv[])
+{
+    int pid, mask;
+
+    if(argc > 2) {
+        pid = atoi(argv[1]);
+        mask = atoi(argv[2]);
+    }
+    else {
+        printf(1, "usage: set_affinity pid cpumask\n");
+        exit();
+    }
+
+    if(set_affinity(pid, mask) < 0)
+        printf(1, "set_affinity failed\n");
+
+    exit();
+}
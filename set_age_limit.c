@@ -0,0 +1,23 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+int main(int argc, char *argv[])
+{
+    int n;
+
+    if(argc > 1) {
+        n = atoi(argv[1]);
+    }
+    else {
+        printf(1, "usage: set_age_limit ticks (0 disables aging)\n");
+        exit();
+    }
+
+    if(set_age_limit(n) < 0)
+        printf(1, "set_age_limit failed\n");
+
+    exit();
+}
@@ -0,0 +1,26 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+int main(int argc, char *argv[])
+{
+    int pid, period, runtime, deadline;
+
+    if(argc > 3) {
+        pid = atoi(argv[1]);
+        period = atoi(argv[2]);
+        runtime = atoi(argv[3]);
+        deadline = argc > 4 ? atoi(argv[4]) : period;
+    }
+    else {
+        printf(1, "usage: set_deadline pid period runtime [deadline]\n");
+        exit();
+    }
+
+    if(set_deadline(pid, period, runtime, deadline) < 0)
+        printf(1, "set_deadline failed\n");
+
+    exit();
+}
@@ -0,0 +1,24 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+int main(int argc, char *argv[])
+{
+    int pgid, on, n;
+
+    if(argc > 2) {
+        pgid = atoi(argv[1]);
+        on = atoi(argv[2]);
+    }
+    else {
+        printf(1, "usage: set_gang pgid 0|1\n");
+        exit();
+    }
+
+    n = set_gang(pgid, on);
+    printf(1, "%d processes in group %d\n", n, pgid);
+
+    exit();
+}
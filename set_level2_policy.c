@@ -0,0 +1,25 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "sched.h"
+
+int main(int argc, char *argv[])
+{
+    int policy;
+
+    if(argc > 1 && strcmp(argv[1], "lottery") == 0)
+        policy = SCHED_LOTTERY;
+    else if(argc > 1 && strcmp(argv[1], "stride") == 0)
+        policy = SCHED_STRIDE;
+    else {
+        printf(1, "usage: set_level2_policy lottery|stride\n");
+        exit();
+    }
+
+    if(set_level2_policy(policy) < 0)
+        printf(1, "set_level2_policy failed\n");
+
+    exit();
+}
@@ -0,0 +1,24 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+int main(int argc, char *argv[])
+{
+    int level, n;
+
+    if(argc > 2) {
+        level = atoi(argv[1]);
+        n = atoi(argv[2]);
+    }
+    else {
+        printf(1, "usage: set_quantum level ticks\n");
+        exit();
+    }
+
+    if(set_quantum(level, n) < 0)
+        printf(1, "set_quantum failed\n");
+
+    exit();
+}
@@ -3,6 +3,7 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,8 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int spawnable(char*);
+void spawncmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -164,6 +167,10 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(spawnable(buf)){
+      spawncmd(parsecmd(buf));
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait();
@@ -491,3 +498,90 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+//PAGEBREAK!
+// Spawning
+
+// Whether s is a single command, with perhaps some
+// redirections, that parses cleanly and so can be run with
+// spawn() instead of fork() and exec(). Anything else is
+// parsed and run in a child, where a syntax error cannot
+// kill the shell.
+int
+spawnable(char *s)
+{
+  int words, inword;
+
+  words = inword = 0;
+  for(; *s; s++){
+    if(strchr("|&;()", *s))
+      return 0;
+    if(*s == '<' || *s == '>'){
+      // parseredirs() wants a file name next.
+      if(s[0] == '>' && s[1] == '>')
+        s++;
+      s++;
+      while(*s && strchr(whitespace, *s))
+        s++;
+      if(*s == 0 || strchr(symbols, *s))
+        return 0;
+      inword = 0;
+    }
+    if(strchr(whitespace, *s))
+      inword = 0;
+    else if(!inword){
+      inword = 1;
+      words++;
+    }
+  }
+  return words < MAXARGS;
+}
+
+// Run a command that spawnable() accepted. Its redirections
+// are opened here and moved into place by spawn().
+void
+spawncmd(struct cmd *cmd)
+{
+  struct spawn_action act[SPAWN_MAXACT+1];
+  struct redircmd *rcmd;
+  struct execcmd *ecmd;
+  struct cmd *c, *next;
+  int fds[MAXARGS];
+  int i, n, nfd;
+
+  n = nfd = 0;
+  for(c = cmd; c->type == REDIR; c = rcmd->cmd){
+    rcmd = (struct redircmd*)c;
+    if((fds[nfd] = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      goto done;
+    }
+    act[n].op = SPAWN_DUP2;
+    act[n].fd = fds[nfd++];
+    act[n].newfd = rcmd->fd;
+    n++;
+  }
+  for(i = 0; i < nfd; i++){
+    act[n].op = SPAWN_CLOSE;
+    act[n].fd = fds[i];
+    n++;
+  }
+  act[n].op = 0;
+
+  ecmd = (struct execcmd*)c;
+  if(ecmd->argv[0]){
+    if(spawn(ecmd->argv[0], ecmd->argv, act) < 0)
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+    else
+      wait();
+  }
+
+done:
+  for(i = 0; i < nfd; i++)
+    close(fds[i]);
+  for(c = cmd; c->type == REDIR; c = next){
+    next = ((struct redircmd*)c)->cmd;
+    free(c);
+  }
+  free(c);
+}
@@ -0,0 +1,11 @@
+// File actions for spawn(), applied in order to the child's
+// copy of the parent's open files. A list ends with op 0.
+#define SPAWN_CLOSE   1   // close fd
+#define SPAWN_DUP2    2   // make newfd refer to fd's file
+#define SPAWN_MAXACT 32   // most actions in one spawn()
+
+struct spawn_action {
+  int op;
+  int fd;
+  int newfd;
+};
@@ -3,15 +3,16 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "sched.h"
 
 int main(int argc, char *argv[])
 {
     int p_ratio, t_ratio, c_ratio;
 
     if(argc > 3) {
-        p_ratio = atoi(argv[1]);
-        t_ratio = atoi(argv[2]);
-        c_ratio = atoi(argv[3]);
+        p_ratio = atofix(argv[1], BJF_SCALE);
+        t_ratio = atofix(argv[2], BJF_SCALE);
+        c_ratio = atofix(argv[3], BJF_SCALE);
     }
     else {
         printf(1, "Insufficient inputs\n", sizeof("Insufficient inputs\n"));
@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(uvmtouch(curproc->pgdir, curproc->sz, addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,9 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) &&
+       uvmtouch(curproc->pgdir, curproc->sz, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -65,6 +70,9 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  // The kernel may write the block, e.g. in read().
+  if(uvmtouch(curproc->pgdir, curproc->sz, i, size, 1) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -112,6 +120,21 @@ extern int sys_set_tickets(void);
 extern int sys_print_process(void);
 extern int sys_sys_set_bjf_params(void);
 extern int sys_proc_set_bjf_params(void);
+extern int sys_set_level2_policy(void);
+extern int sys_set_age_limit(void);
+extern int sys_set_quantum(void);
+extern int sys_getprocstats(void);
+extern int sys_traceread(void);
+extern int sys_set_affinity(void);
+extern int sys_getbalancestats(void);
+extern int sys_setpgid(void);
+extern int sys_set_gang(void);
+extern int sys_set_deadline(void);
+extern int sys_sched_setattr_batch(void);
+extern int sys_nanosleep(void);
+extern int sys_clock_gettime(void);
+extern int sys_freepages(void);
+extern int sys_spawn(void);
 extern int sys_sem_init(void);
 extern int sys_sem_acquire(void);
 extern int sys_sem_release(void);
@@ -150,6 +173,21 @@ static int (*syscalls[])(void) = {
 [SYS_print_process] sys_print_process,
 [SYS_sys_set_bjf_params] sys_sys_set_bjf_params,
 [SYS_proc_set_bjf_params] sys_proc_set_bjf_params,
+[SYS_set_level2_policy] sys_set_level2_policy,
+[SYS_set_age_limit] sys_set_age_limit,
+[SYS_set_quantum] sys_set_quantum,
+[SYS_getprocstats] sys_getprocstats,
+[SYS_traceread] sys_traceread,
+[SYS_set_affinity] sys_set_affinity,
+[SYS_getbalancestats] sys_getbalancestats,
+[SYS_setpgid] sys_setpgid,
+[SYS_set_gang] sys_set_gang,
+[SYS_set_deadline] sys_set_deadline,
+[SYS_sched_setattr_batch] sys_sched_setattr_batch,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_freepages] sys_freepages,
+[SYS_spawn] sys_spawn,
 [SYS_sem_init] sys_sem_init,
 [SYS_sem_acquire] sys_sem_acquire,
 [SYS_sem_release] sys_sem_release,
@@ -166,7 +204,8 @@ syscall(void)
 
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
-    curproc->systemcalls[num] = 1;
+    if(num < 64)
+      curproc->systemcalls |= (uint64)1 << num;
     
   } else {
     cprintf("%d %s: unknown sys call %d\n",
@@ -31,6 +31,21 @@
 #define SYS_print_process 29
 #define SYS_sys_set_bjf_params 30
 #define SYS_proc_set_bjf_params 31
+#define SYS_set_level2_policy 35
+#define SYS_set_age_limit 36
+#define SYS_set_quantum 37
+#define SYS_getprocstats 38
+#define SYS_traceread 39
+#define SYS_set_affinity 40
+#define SYS_getbalancestats 41
+#define SYS_setpgid 42
+#define SYS_set_gang 43
+#define SYS_set_deadline 44
+#define SYS_sched_setattr_batch 45
+#define SYS_nanosleep 46
+#define SYS_clock_gettime 47
+#define SYS_freepages 48
+#define SYS_spawn 49
 
 #define SYS_sem_acquire 32
 #define SYS_sem_init 33
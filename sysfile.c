@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -393,19 +394,17 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the null-terminated argument vector at user address
+// uargv into argv, which has room for MAXARG pointers.
+static int
+fetchargv(uint uargv, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
-  uint uargv, uarg;
+  uint uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +415,51 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  struct spawn_action act[SPAWN_MAXACT];
+  uint uargv, uact;
+  int n, op;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 ||
+     argint(2, (int*)&uact) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  // A null action list means none.
+  for(n = 0; uact; n++, uact += sizeof(act[0])){
+    if(fetchint(uact, &op) < 0)
+      return -1;
+    if(op == 0)
+      break;
+    if(n >= SPAWN_MAXACT)
+      return -1;
+    act[n].op = op;
+    if(fetchint(uact+4, &act[n].fd) < 0 || fetchint(uact+8, &act[n].newfd) < 0)
+      return -1;
+  }
+  return spawn(path, argv, act, n);
+}
+
 int
 sys_pipe(void)
 {
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "sched.h"
 
 
 int sys_fork(void)
@@ -54,23 +55,27 @@ int sys_sbrk(void)
 int sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if (argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while (ticks - ticks0 < n)
-  {
-    if (myproc()->killed)
-    {
-      release(&tickslock);
+  return tsleep(n);
+}
+
+// Sleep for the time in *req, to the microsecond.
+int sys_nanosleep(void)
+{
+  struct timespec *req;
+  int s;
+
+  if (argptr(0, (char **)&req, sizeof(*req)) < 0)
+    return -1;
+  if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+    return -1;
+  // One second at a time keeps usleep() within 32 bits.
+  for (s = 0; s < req->tv_sec; s++)
+    if (usleep(1000000) < 0)
       return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return usleep((req->tv_nsec + 999) / 1000);
 }
 
 // return how many clock tick interrupts have occurred
@@ -151,6 +156,124 @@ int sys_proc_set_bjf_params(void)
   return proc_set_bjf_params(pid,p,t,c);
 }
 
+int sys_set_level2_policy(void)
+{
+  int policy;
+  if (argint(0, &policy) < 0)
+    return -1;
+  return rq_setpolicy(policy);
+}
+
+int sys_set_age_limit(void)
+{
+  int n;
+  if (argint(0, &n) < 0)
+    return -1;
+  return rq_setagelimit(n);
+}
+
+int sys_set_quantum(void)
+{
+  int level, n;
+  if (argint(0, &level) < 0 || argint(1, &n) < 0)
+    return -1;
+  return rq_setquantum(level, n);
+}
+
+int sys_getprocstats(void)
+{
+  int pid;
+  struct procstats *st;
+  if (argint(0, &pid) < 0 || argptr(1, (char **)&st, sizeof(*st)) < 0)
+    return -1;
+  return getprocstats(pid, st);
+}
+
+int sys_set_affinity(void)
+{
+  int pid, mask;
+  if (argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return set_affinity(pid, mask);
+}
+
+int sys_setpgid(void)
+{
+  int pid, pgid;
+  if (argint(0, &pid) < 0 || argint(1, &pgid) < 0)
+    return -1;
+  return setpgid(pid, pgid);
+}
+
+int sys_set_gang(void)
+{
+  int pgid, on;
+  if (argint(0, &pgid) < 0 || argint(1, &on) < 0)
+    return -1;
+  return set_gang(pgid, on);
+}
+
+int sys_set_deadline(void)
+{
+  int pid, period, runtime, deadline;
+  if (argint(0, &pid) < 0 || argint(1, &period) < 0 ||
+      argint(2, &runtime) < 0 || argint(3, &deadline) < 0)
+    return -1;
+  return set_deadline(pid, period, runtime, deadline);
+}
+
+int sys_sched_setattr_batch(void)
+{
+  int n;
+  struct sched_attr *a;
+  if (argint(1, &n) < 0 || n < 0 || argptr(0, (char **)&a, n * sizeof(*a)) < 0)
+    return -1;
+  return sched_setattr_batch(a, n);
+}
+
+int sys_freepages(void)
+{
+  return kfreepages();
+}
+
+int sys_clock_gettime(void)
+{
+  int clock;
+  struct timespec *tp;
+  if (argint(0, &clock) < 0 || argptr(1, (char **)&tp, sizeof(*tp)) < 0)
+    return -1;
+  if (clock != CLOCK_MONOTONIC)
+    return -1;
+  monotime(tp);
+  return 0;
+}
+
+int sys_getbalancestats(void)
+{
+  int n;
+  struct balancestat *st;
+  if (argint(1, &n) < 0 || n < 0)
+    return -1;
+  // Only ncpu entries are filled; a bigger n could also wrap
+  // the byte count past argptr's check.
+  if (n > ncpu)
+    n = ncpu;
+  if (argptr(0, (char **)&st, n * sizeof(*st)) < 0)
+    return -1;
+  return rq_balancestats(st, n);
+}
+
+int sys_traceread(void)
+{
+  int n;
+  struct traceevent *ev;
+  // Reject an n whose byte count would wrap past argptr's check.
+  if (argint(1, &n) < 0 || n < 0 || n > 0x7fffffff / sizeof(*ev) ||
+      argptr(0, (char **)&ev, n * sizeof(*ev)) < 0)
+    return -1;
+  return traceread(ev, n);
+}
+
 //-------------------------------------
 
 int sys_sem_init(void)
@@ -0,0 +1,306 @@
+// Kernel timers.
+//
+// Tick timers sit on a hierarchical timing wheel: NWHEEL
+// levels of WHEELSIZE slots, level i holding the timers due
+// in fewer than WHEELSIZE^(i+1) ticks. CPU 0 turns the wheel
+// once per tick. Whenever a level's index wraps to 0, the
+// current slot of the level above is cascaded down, so a
+// timer is moved at most NWHEEL-1 times and is woken exactly
+// on its tick instead of every sleeper waking every tick.
+//
+// Sub-tick sleeps use each CPU's LAPIC timer. hrsleep() puts
+// it in one-shot mode to fire partway through the current
+// tick, and a second one-shot finishes that tick, so the tick
+// rate is not disturbed. Elapsed time is measured with the
+// TSC; see lapiccalibrate().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "date.h"
+
+#define WHEELBITS 6
+#define WHEELSIZE (1 << WHEELBITS)
+#define WHEELMASK (WHEELSIZE - 1)
+#define NWHEEL    4
+#define MAXDELAY  ((1 << (WHEELBITS*NWHEEL)) - 1)
+
+#define TICK_US   (1000000 / HZ)
+#define HRMARGIN  64      // LAPIC counts kept clear of a tick
+
+// States of cpu->hrstate.
+#define HR_IDLE   0       // LAPIC timer is periodic
+#define HR_SHOT   1       // one-shot armed for an hrsleep()
+#define HR_REST   2       // one-shot armed for the rest of the tick
+
+struct timer {
+  struct timer *next;
+  struct timer *prev;
+  uint expires;           // tick to fire on
+  int fired;
+};
+
+static struct {
+  struct spinlock lock;
+  uint now;               // next tick to run
+  struct timer *slot[NWHEEL][WHEELSIZE];
+} wheel;
+
+static struct spinlock hrlock;
+
+void
+timerinit(void)
+{
+  initlock(&wheel.lock, "wheel");
+  initlock(&hrlock, "hrtimer");
+}
+
+// Put t in the slot for t->expires. A timer further out than
+// the wheel reaches is parked at its far end and placed again
+// when cascaded.
+static void
+timeradd(struct timer *t)
+{
+  struct timer **s;
+  uint delta;
+  int lvl;
+
+  delta = t->expires - wheel.now;
+  if((int)delta < 0)
+    delta = 0;
+  if(delta > MAXDELAY)
+    delta = MAXDELAY;
+  for(lvl = 0; lvl < NWHEEL-1 && delta >= (1 << (WHEELBITS*(lvl+1))); lvl++)
+    ;
+  s = &wheel.slot[lvl][((wheel.now + delta) >> (WHEELBITS*lvl)) & WHEELMASK];
+  t->prev = 0;
+  t->next = *s;
+  if(*s)
+    (*s)->prev = t;
+  *s = t;
+}
+
+static void
+timerdel(struct timer *t, struct timer **s)
+{
+  if(t->prev)
+    t->prev->next = t->next;
+  else
+    *s = t->next;
+  if(t->next)
+    t->next->prev = t->prev;
+}
+
+// Take t off whichever slot it is in.
+static void
+timercancel(struct timer *t)
+{
+  struct timer **s;
+  int lvl, i;
+
+  for(lvl = 0; lvl < NWHEEL; lvl++){
+    for(i = 0; i < WHEELSIZE; i++){
+      for(s = &wheel.slot[lvl][i]; *s; s = &(*s)->next){
+        if(*s == t){
+          timerdel(t, &wheel.slot[lvl][i]);
+          return;
+        }
+      }
+    }
+  }
+}
+
+// Called by CPU 0 on every tick, after updating ticks.
+void
+timertick(void)
+{
+  struct timer *t, **s;
+  int lvl;
+
+  acquire(&wheel.lock);
+  while((int)(ticks - wheel.now) >= 0){
+    for(lvl = 1; lvl < NWHEEL; lvl++){
+      if(((wheel.now >> (WHEELBITS*(lvl-1))) & WHEELMASK) != 0)
+        break;
+      s = &wheel.slot[lvl][(wheel.now >> (WHEELBITS*lvl)) & WHEELMASK];
+      while((t = *s) != 0){
+        timerdel(t, s);
+        timeradd(t);
+      }
+    }
+    s = &wheel.slot[0][wheel.now & WHEELMASK];
+    while((t = *s) != 0){
+      timerdel(t, s);
+      t->fired = 1;
+      wakeup(t);
+    }
+    wheel.now++;
+  }
+  release(&wheel.lock);
+}
+
+// Sleep for n ticks. Returns -1 if killed first.
+int
+tsleep(int n)
+{
+  struct timer t;
+
+  if(n <= 0)
+    return 0;
+  acquire(&wheel.lock);
+  t.expires = ticks + n;
+  t.fired = 0;
+  timeradd(&t);
+  while(!t.fired){
+    if(myproc()->killed){
+      // Rare, so finding the slot the slow way is fine.
+      timercancel(&t);
+      release(&wheel.lock);
+      return -1;
+    }
+    sleep(&t, &wheel.lock);
+  }
+  release(&wheel.lock);
+  return 0;
+}
+
+//PAGEBREAK!
+// Sleep for up to n LAPIC timer counts, ending before this
+// CPU's next tick. Returns 0 after sleeping, 1 if the tick is
+// too close to bother, and -1 if another process already has
+// this CPU's one-shot.
+static int
+hrsleep(uint n)
+{
+  struct cpu *c;
+  uint left;
+
+  // Holding hrlock also keeps us on this CPU until sleep().
+  acquire(&hrlock);
+  c = mycpu();
+  if(c->hrstate != HR_IDLE){
+    release(&hrlock);
+    return -1;
+  }
+  left = lapicleft();
+  if(left < 2*HRMARGIN){
+    release(&hrlock);
+    return 1;
+  }
+  if(n > left - HRMARGIN)
+    n = left - HRMARGIN;
+  c->hrstate = HR_SHOT;
+  c->hrrest = left - n;
+  lapiconeshot(n);
+  while(c->hrstate == HR_SHOT && !myproc()->killed)
+    sleep(&c->hrstate, &hrlock);
+  release(&hrlock);
+  return 0;
+}
+
+// Called on every LAPIC timer interrupt. Returns 1 if it was
+// an hrsleep() one-shot rather than a tick.
+int
+hrtimerintr(void)
+{
+  struct cpu *c = mycpu();
+  int r;
+
+  if(c->hrstate == HR_IDLE)
+    return 0;
+  acquire(&hrlock);
+  if(c->hrstate == HR_SHOT){
+    c->hrstate = HR_REST;
+    lapiconeshot(c->hrrest);
+    wakeup(&c->hrstate);
+    r = 1;
+  } else {
+    c->hrstate = HR_IDLE;
+    lapicperiodic();
+    r = 0;
+  }
+  release(&hrlock);
+  return r;
+}
+
+// Sleep for at least us microseconds: whole ticks on the
+// wheel while more than two ticks remain, then the rest on
+// LAPIC one-shots. Returns -1 if killed first.
+int
+usleep(uint us)
+{
+  uint64 deadline, now;
+  uint left;
+
+  if(tscperus == 0 || lapicperus == 0)
+    return tsleep((us + TICK_US - 1) / TICK_US);
+  deadline = rdtsc() + (uint64)us * tscperus;
+  for(;;){
+    if(myproc()->killed)
+      return -1;
+    now = rdtsc();
+    if(now >= deadline)
+      return 0;
+    left = div64(deadline - now, tscperus);
+    if(left >= 2*TICK_US){
+      if(tsleep(left/TICK_US - 1) < 0)
+        return -1;
+    } else if(hrsleep(left * lapicperus) < 0){
+      if(tsleep(1) < 0)
+        return -1;
+    }
+  }
+}
+
+//PAGEBREAK!
+// Divide n by d, for any n; two divl steps, each with a
+// 32-bit quotient.
+static uint64
+udiv64(uint64 n, uint d, uint *rem)
+{
+  uint hi = n >> 32;
+  uint64 q;
+
+  q = ((uint64)(hi / d) << 32) | div64(((uint64)(hi % d) << 32) | (uint)n, d);
+  if(rem)
+    *rem = n - q*d;
+  return q;
+}
+
+// Nanoseconds in tsc TSC cycles.
+uint64
+tsctons(uint64 tsc)
+{
+  uint64 ms;
+  uint r;
+
+  if(tscperms == 0)
+    return 0;
+  ms = udiv64(tsc, tscperms, &r);
+  return ms*1000000 + div64((uint64)r*1000000, tscperms);
+}
+
+// Monotonic time since boot in nanoseconds, from the TSC,
+// or from ticks if it could not be calibrated.
+uint64
+nsuptime(void)
+{
+  if(tscperms == 0)
+    return (uint64)ticks * (1000000000 / HZ);
+  return tsctons(rdtsc() - tscboot);
+}
+
+// CLOCK_MONOTONIC for clock_gettime().
+void
+monotime(struct timespec *ts)
+{
+  uint ns;
+
+  ts->tv_sec = udiv64(nsuptime(), 1000000000, &ns);
+  ts->tv_nsec = ns;
+}
@@ -0,0 +1,86 @@
+// Scheduler event tracing.
+//
+// Each CPU has a ring of trace events that only it writes,
+// with interrupts off, so recording takes no lock: the event
+// is filled in before head is advanced, and a full ring drops
+// new events rather than overwrite unread ones. Readers drain
+// every ring through traceread(), serialized by trace.lock,
+// and advance tail once they have copied the events out.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sched.h"
+
+#define NTRACE 512  // events per CPU, a power of two
+
+struct tracebuf {
+  struct traceevent ev[NTRACE];
+  volatile uint head;   // next slot to write
+  volatile uint tail;   // next slot to read
+};
+
+struct {
+  struct spinlock lock; // serializes readers
+  struct tracebuf buf[NCPU];
+} trace;
+
+void
+traceinit(void)
+{
+  initlock(&trace.lock, "trace");
+}
+
+// Record event type for p on this CPU. arg is the queue
+// level the event applies to.
+void
+tracesched(int type, struct proc *p, int arg)
+{
+  struct tracebuf *b;
+  struct traceevent *e;
+  int cpu;
+
+  pushcli();
+  cpu = cpuid();
+  b = &trace.buf[cpu];
+  if(b->head - b->tail < NTRACE){
+    e = &b->ev[b->head & (NTRACE-1)];
+    e->tsc = rdtsc();
+    e->pid = p->pid;
+    e->type = type;
+    e->level = arg;
+    e->cpu = cpu;
+    __sync_synchronize();
+    b->head++;
+  }
+  popcli();
+}
+
+// Move up to n buffered events from all CPUs into ev.
+// Returns the number copied.
+int
+traceread(struct traceevent *ev, int n)
+{
+  struct tracebuf *b;
+  uint h;
+  int i;
+
+  i = 0;
+  acquire(&trace.lock);
+  for(b = trace.buf; b < &trace.buf[NCPU] && i < n; b++){
+    h = b->head;
+    __sync_synchronize();
+    while(b->tail != h && i < n){
+      ev[i++] = b->ev[b->tail & (NTRACE-1)];
+      __sync_synchronize();
+      b->tail++;
+    }
+  }
+  release(&trace.lock);
+  return i;
+}
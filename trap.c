@@ -32,10 +32,28 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Handle a page fault at va by p's user code: the first touch
+// of a heap page sbrk() reserved, or a write to a copy-on-write
+// page. Returns -1 for any other fault, which is p's own.
+// The kernel never faults on p's memory: system calls check
+// their arguments with uvmtouch(), which faults in those pages
+// and copies them if the kernel may write them.
+static int
+pgfault(struct proc *p, uint va, uint err)
+{
+  if(!(err & FEC_PR))
+    return lazyfault(p->pgdir, p->sz, va);
+  if(err & FEC_WR)
+    return cowfault(p->pgdir, va);
+  return -1;
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
 {
+  int tick = 0;
+
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -48,18 +66,37 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    if(hrtimerintr()){
+      lapiceoi();
+      break;
+    }
+    tick = 1;
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
       release(&tickslock);
+      timertick();
     }
+    mycpu()->ticks++;
+    if(mycpu()->idle)
+      mycpu()->idleticks++;
+    rq_age(cpuid());
+    rq_replenish(cpuid());
+    rq_balance(cpuid());
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKEUP:
+    // Only here to end a hlt in scheduler().
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Another CPU started a gang; see the yield check below.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     break;
@@ -78,6 +115,12 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    if(myproc() && (tf->cs&3) == DPL_USER &&
+       pgfault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -100,10 +143,15 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick once its time
+  // slice is used up or a higher-level process is waiting, or
+  // when another CPU has started a gang it is not part of.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tick && rq_tick(myproc()))
+    yield();
+  else if(myproc() && myproc()->state == RUNNING &&
+     tf->trapno == T_IRQ0+IRQ_RESCHED && rq_gangpreempt(myproc()))
     yield();
 
   // Check if the process has been killed since we yielded
@@ -22,6 +22,11 @@
 #define T_MCHK          18      // machine check
 #define T_SIMDERR       19      // SIMD floating point error
 
+// Page fault error code bits.
+#define FEC_PR        0x1       // protection violation, not missing page
+#define FEC_WR        0x2       // caused by a write
+#define FEC_U         0x4       // from user mode
+
 // These are arbitrarily chosen, but with care not to overlap
 // processor defined exceptions or interrupt vectors.
 #define T_SYSCALL       64      // system call
@@ -34,5 +39,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_RESCHED     29      // IPI to make a CPU reschedule
+#define IRQ_WAKEUP      30      // IPI to wake a halted CPU
 #define IRQ_SPURIOUS    31
 
@@ -1,4 +1,6 @@
 typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
+typedef unsigned long long uint64;
+typedef long long int64;
 typedef uint pde_t;
@@ -92,6 +92,24 @@ atoi(const char *s)
   return n;
 }
 
+// Parse a decimal such as "1.25" into fixed point,
+// scaled by scale (a power of ten).
+int
+atofix(const char *s, int scale)
+{
+  int n, f;
+
+  n = atoi(s) * scale;
+  while('0' <= *s && *s <= '9')
+    s++;
+  if(*s == '.'){
+    s++;
+    for(f = scale/10; f > 0 && '0' <= *s && *s <= '9'; f /= 10)
+      n += (*s++ - '0') * f;
+  }
+  return n;
+}
+
 void reverse(char s[])
  {
      int i, j;
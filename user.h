@@ -1,5 +1,11 @@
 struct stat;
 struct rtcdate;
+struct timespec;
+struct procstats;
+struct traceevent;
+struct balancestat;
+struct sched_attr;
+struct spawn_action;
 
 // system calls
 int fork(void);
@@ -33,6 +39,21 @@ int set_tickets(int, int);
 int print_process(void);
 int sys_set_bjf_params(int,int,int);
 int proc_set_bjf_params(int,int,int,int);
+int set_level2_policy(int);
+int set_age_limit(int);
+int set_quantum(int, int);
+int getprocstats(int, struct procstats*);
+int traceread(struct traceevent*, int);
+int set_affinity(int, int);
+int getbalancestats(struct balancestat*, int);
+int setpgid(int, int);
+int set_gang(int, int);
+int set_deadline(int, int, int, int);
+int sched_setattr_batch(struct sched_attr*, int);
+int nanosleep(struct timespec*);
+int clock_gettime(int, struct timespec*);
+int freepages(void);
+int spawn(char*, char**, struct spawn_action*);
 
 int sem_init(int, int);
 int sem_acquire(int);
@@ -52,4 +73,5 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int atofix(const char*, int);
 void itoa(int n, char s[]);
@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "date.h"
+#include "spawn.h"
 
 char buf[8192];
 char name[3];
@@ -400,6 +402,423 @@ preempt(void)
   printf(1, "preempt ok\n");
 }
 
+// Monotonic microseconds, for timing the benchmarks below.
+uint
+usnow(void)
+{
+  struct timespec ts;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0){
+    printf(1, "clock_gettime failed\n");
+    exit();
+  }
+  return ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// CPU-bound children, like foo.c, to see how throughput
+// scales with the number of CPUs the scheduler can use.
+void
+schedscale(void)
+{
+  int n, i, pid;
+  uint t0, t;
+  volatile int x;
+
+  printf(1, "schedscale test\n");
+  for(n = 1; n <= 8; n *= 2){
+    t0 = usnow();
+    for(i = 0; i < n; i++){
+      pid = fork();
+      if(pid < 0){
+        printf(1, "fork failed\n");
+        exit();
+      }
+      if(pid == 0){
+        for(x = 0; x < 20000000; x++)
+          ;
+        exit();
+      }
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    t = (usnow() - t0) / 1000;
+    if(t == 0)
+      t = 1;
+    printf(1, "schedscale: %d children %d ms %d jobs/1000 s\n",
+           n, t, n*1000000/t);
+  }
+  printf(1, "schedscale ok\n");
+}
+
+// One gangbench run: GANGW workers in their own process group
+// meet at a pipe barrier every round while GANGHOG spinning
+// processes outside the group compete for the CPUs.
+#define GANGW 4
+#define GANGHOG 4
+#define GANGROUNDS 200
+
+void
+gangrun(int on)
+{
+  int up[2], down[GANGW][2], hog[GANGHOG];
+  int i, r, pid;
+  uint t0, t;
+  volatile int x;
+  char c;
+
+  setpgid(0, 0);
+  set_gang(getpid(), on);
+  for(i = 0; i < GANGHOG; i++){
+    hog[i] = fork();
+    if(hog[i] < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(hog[i] == 0){
+      setpgid(0, 0);
+      set_gang(getpid(), 0);
+      for(;;)
+        ;
+    }
+  }
+  if(pipe(up) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < GANGW; i++){
+    if(pipe(down[i]) < 0){
+      printf(1, "pipe failed\n");
+      exit();
+    }
+  }
+
+  t0 = usnow();
+  for(i = 0; i < GANGW; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(r = 0; r < GANGROUNDS; r++){
+        for(x = 0; x < 20000; x++)
+          ;
+        if(write(up[1], "b", 1) != 1 || read(down[i][0], &c, 1) != 1){
+          printf(1, "gangbench barrier failed\n");
+          exit();
+        }
+      }
+      exit();
+    }
+  }
+  for(r = 0; r < GANGROUNDS; r++){
+    for(i = 0; i < GANGW; i++)
+      read(up[0], &c, 1);
+    for(i = 0; i < GANGW; i++)
+      write(down[i][1], "g", 1);
+  }
+  for(i = 0; i < GANGW; i++)
+    wait();
+  t = usnow() - t0;
+
+  for(i = 0; i < GANGHOG; i++){
+    kill(hog[i]);
+    wait();
+  }
+  printf(1, "gangbench: gang %s: %d rounds %d us\n",
+         on ? "on" : "off", GANGROUNDS, t);
+}
+
+// Barrier-heavy throughput with and without gang mode.
+void
+gangbench(void)
+{
+  int on;
+
+  printf(1, "gangbench test\n");
+  for(on = 0; on <= 1; on++){
+    if(fork() == 0){
+      gangrun(on);
+      exit();
+    }
+    wait();
+  }
+  printf(1, "gangbench ok\n");
+}
+
+// Allocator throughput: n children each grow and shrink their
+// heap and fork short-lived children, so nearly all the work
+// is kalloc() and kfree(). Pages per ms should grow with n up
+// to the number of CPUs.
+#define ALLOCROUNDS 200
+#define ALLOCPAGES 32
+
+void
+allocbench(void)
+{
+  int n, i, j, r, pid;
+  uint t0, t, pages;
+  char *a;
+
+  printf(1, "allocbench test\n");
+  for(n = 1; n <= 8; n *= 2){
+    t0 = usnow();
+    for(i = 0; i < n; i++){
+      pid = fork();
+      if(pid < 0){
+        printf(1, "fork failed\n");
+        exit();
+      }
+      if(pid == 0){
+        for(r = 0; r < ALLOCROUNDS; r++){
+          a = sbrk(ALLOCPAGES*4096);
+          if(a == (char*)-1){
+            printf(1, "allocbench sbrk failed\n");
+            exit();
+          }
+          // sbrk is lazy: touch each page so it is allocated.
+          for(j = 0; j < ALLOCPAGES; j++)
+            a[j*4096] = 1;
+          sbrk(-ALLOCPAGES*4096);
+          if(r % 8 == 0){
+            pid = fork();
+            if(pid == 0)
+              exit();
+            if(pid > 0)
+              wait();
+          }
+        }
+        exit();
+      }
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    t = (usnow() - t0) / 1000;
+    if(t == 0)
+      t = 1;
+    pages = n * ALLOCROUNDS * ALLOCPAGES;
+    printf(1, "allocbench: %d children %d ms %d pages/ms\n",
+           n, t, pages/t);
+  }
+  printf(1, "allocbench ok\n");
+}
+
+// fork+exec from a large parent, as sh does for every command.
+// With copy-on-write fork the child's exec should not pay for
+// the parent's size, and fork should only cost page tables.
+#define COWPAGES 1024
+#define COWROUNDS 50
+
+void
+cowbench(void)
+{
+  char *argv[] = { "echo", 0 };
+  char *p;
+  int i, pid, before, used;
+  uint t0, t;
+
+  printf(1, "cowbench test\n");
+  p = sbrk(COWPAGES*4096);
+  if(p == (char*)-1){
+    printf(1, "cowbench sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < COWPAGES; i++)
+    p[i*4096] = i;
+
+  before = freepages();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    used = before - freepages();
+    printf(1, "cowbench: fork of %d-page parent used %d pages, "
+           "saved %d\n", COWPAGES, used, COWPAGES - used);
+    // Writes still see private copies of the parent's data.
+    for(i = 0; i < COWPAGES; i++){
+      if(p[i*4096] != (char)i){
+        printf(1, "cowbench: child read wrong data\n");
+        exit();
+      }
+      p[i*4096] = ~i;
+    }
+    exit();
+  }
+  wait();
+  for(i = 0; i < COWPAGES; i++){
+    if(p[i*4096] != (char)i){
+      printf(1, "cowbench: child write reached parent\n");
+      exit();
+    }
+  }
+
+  t0 = usnow();
+  for(i = 0; i < COWROUNDS; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(1);  // keep echo quiet
+      exec("echo", argv);
+      exit();
+    }
+    wait();
+  }
+  t = usnow() - t0;
+  printf(1, "cowbench: fork+exec %d us each\n", t / COWROUNDS);
+  sbrk(-COWPAGES*4096);
+  printf(1, "cowbench ok\n");
+}
+
+// A system call writing into a page the child still shares
+// with its parent must copy it, not write the parent's page.
+void
+cowread(void)
+{
+  char *p;
+  int fds[2], i, pid, ppid;
+
+  printf(1, "cow read test\n");
+  p = sbrk(4096);
+  if(p == (char*)-1){
+    printf(1, "cow read sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 4096; i++)
+    p[i] = 'p';
+
+  ppid = getpid();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(pipe(fds) < 0 || write(fds[1], "child", 5) != 5 ||
+       read(fds[0], p + 100, 5) != 5){
+      printf(1, "cow read: read into shared page failed\n");
+      kill(ppid);
+      exit();
+    }
+    if(p[100] != 'c' || p[104] != 'd' || p[99] != 'p' || p[105] != 'p'){
+      printf(1, "cow read: child sees wrong data\n");
+      kill(ppid);
+      exit();
+    }
+    exit();
+  }
+  wait();
+  for(i = 0; i < 4096; i++){
+    if(p[i] != 'p'){
+      printf(1, "cow read: child's read reached parent\n");
+      exit();
+    }
+  }
+  sbrk(-4096);
+  printf(1, "cow read ok\n");
+}
+
+// Run a sh script of SPAWNCMDS copies of line, which sh runs
+// with spawn() for a plain command and fork() for a (block).
+// Returns the time taken in microseconds.
+#define SPAWNCMDS 1000
+
+uint
+spawnscript(char *line)
+{
+  char *argv[] = { "sh", 0 };
+  int fd, i, n, pid;
+  uint t0;
+
+  n = strlen(line);
+  fd = open("spawnsh", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "spawnbench create failed\n");
+    exit();
+  }
+  for(i = 0; i < SPAWNCMDS; i++)
+    memmove(buf + i*n, line, n);
+  if(write(fd, buf, SPAWNCMDS*n) != SPAWNCMDS*n){
+    printf(1, "spawnbench write failed\n");
+    exit();
+  }
+  close(fd);
+
+  t0 = usnow();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(0);
+    close(1);
+    close(2);
+    open("spawnsh", O_RDONLY);
+    open("spawnout", O_CREATE|O_RDWR);
+    dup(1);
+    exec("sh", argv);
+    exit();
+  }
+  wait();
+  return usnow() - t0;
+}
+
+// Launch echo many times with spawn() and with fork()+exec(),
+// directly and from a sh script.
+void
+spawnbench(void)
+{
+  char *argv[] = { "echo", 0 };
+  struct spawn_action act[2];
+  int i, pid;
+  uint t0, tfork, tspawn;
+
+  printf(1, "spawnbench test\n");
+  t0 = usnow();
+  for(i = 0; i < SPAWNCMDS; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(1);
+      exec("echo", argv);
+      exit();
+    }
+    wait();
+  }
+  tfork = usnow() - t0;
+
+  act[0].op = SPAWN_CLOSE;
+  act[0].fd = 1;
+  act[1].op = 0;
+  t0 = usnow();
+  for(i = 0; i < SPAWNCMDS; i++){
+    if(spawn("echo", argv, act) < 0){
+      printf(1, "spawn failed\n");
+      exit();
+    }
+    wait();
+  }
+  tspawn = usnow() - t0;
+  printf(1, "spawnbench: %d echos: fork+exec %d us, spawn %d us\n",
+         SPAWNCMDS, tfork, tspawn);
+
+  tfork = spawnscript("(echo)\n");
+  tspawn = spawnscript("echo\n");
+  printf(1, "spawnbench: sh script of %d echos: fork+exec %d us, "
+         "spawn %d us\n", SPAWNCMDS, tfork, tspawn);
+  unlink("spawnsh");
+  unlink("spawnout");
+  printf(1, "spawnbench ok\n");
+}
+
 // try to find any races between exit and wait
 void
 exitwait(void)
@@ -1383,7 +1802,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<NPROC; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +1810,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == NPROC){
+    printf(1, "fork claimed to work %d times!\n", NPROC);
     exit();
   }
 
@@ -1408,6 +1827,16 @@ forktest(void)
     exit();
   }
 
+  // The limit may be NPROC or memory; either must be transient.
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed after children were reaped\n");
+    exit();
+  }
+  if(pid == 0)
+    exit();
+  wait();
+
   printf(1, "fork test OK\n");
 }
 
@@ -1559,6 +1988,61 @@ validateint(int *p)
       "ebx");
 }
 
+// sbrk() only reserves address space: pages appear on first
+// touch, from user code or a system call, and only there.
+void
+lazysbrk(void)
+{
+  char *a;
+  int fds[2], before, pid, ppid;
+
+  printf(stdout, "lazy sbrk test\n");
+  before = freepages();
+  a = sbrk(1024*4096);
+  if(a == (char*)-1){
+    printf(stdout, "lazy sbrk failed\n");
+    exit();
+  }
+  if(before - freepages() > 1){
+    printf(stdout, "lazy sbrk allocated %d pages\n", before - freepages());
+    exit();
+  }
+  if(a[512*4096] != 0){
+    printf(stdout, "lazy sbrk page not zero\n");
+    exit();
+  }
+  a[512*4096] = 1;
+  // A system call writing to an untouched page.
+  if(pipe(fds) < 0 || write(fds[1], "x", 1) != 1 ||
+     read(fds[0], a + 700*4096, 1) != 1 || a[700*4096] != 'x'){
+    printf(stdout, "lazy sbrk read into new page failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(before - freepages() > 4){
+    printf(stdout, "lazy sbrk touched too much\n");
+    exit();
+  }
+  // Past the break is still a fault that kills the process.
+  ppid = getpid();
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    a = sbrk(0);
+    a[4096] = 1;
+    printf(stdout, "lazy sbrk wrote past the break\n");
+    kill(ppid);
+    exit();
+  }
+  wait();
+  sbrk(-1024*4096);
+  printf(stdout, "lazy sbrk ok\n");
+}
+
 void
 validatetest(void)
 {
@@ -1768,6 +2252,7 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazysbrk();
   validatetest();
 
   opentest();
@@ -1783,6 +2268,12 @@ main(int argc, char *argv[])
   pipe1();
   preempt();
   exitwait();
+  schedscale();
+  gangbench();
+  allocbench();
+  cowbench();
+  cowread();
+  spawnbench();
 
   rmdot();
   fourteen();
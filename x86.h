@@ -117,6 +117,36 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and wait for one. sti only takes effect
+// after the next instruction, so no interrupt can be taken
+// between the two and then missed by hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 tsc;
+
+  asm volatile("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+// Divide n by d. The quotient must fit in 32 bits;
+// divl does what libgcc would otherwise be needed for.
+static inline uint
+div64(uint64 n, uint d)
+{
+  uint q, r;
+
+  asm volatile("divl %4" : "=a" (q), "=d" (r) :
+               "a" ((uint)n), "d" ((uint)(n >> 32)), "rm" (d));
+  return q;
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -130,6 +160,19 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Add n to *addr atomically and return the new value.
+static inline uint
+atomicadd(volatile uint *addr, int n)
+{
+  int old = n;
+
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (old), "+m" (*addr) :
+               :
+               "cc");
+  return old + n;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +187,13 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+// Drop any TLB entry for virtual address va.
+static inline void
+invlpg(void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().